@@ -0,0 +1,142 @@
+// Arquivo: 06_matrix.cpp
+// Tópico: Matriz contígua (matrix.h) vs vetor de vetores
+//
+// Compilar com: g++ -std=c++20 -O3 -march=native -pthread -o programa 06_matrix.cpp
+// Uso: ./programa [n]     (matrizes n x n, padrão 1024)
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include "matrix.h"
+using namespace std;
+
+using Nested = vector<vector<double>>;
+
+// Mede o tempo de f() em milissegundos (melhor de 3 execuções).
+template<class F>
+double medir(F f) {
+    double melhor = 1e30;
+    for (int r = 0; r < 3; r++) {
+        auto inicio = chrono::steady_clock::now();
+        f();
+        auto fim = chrono::steady_clock::now();
+        melhor = min(melhor, chrono::duration<double, milli>(fim - inicio).count());
+    }
+    return melhor;
+}
+
+void linha(const string& operacao, const string& versao, double ms, double erro) {
+    cout << left << setw(18) << operacao << setw(26) << versao << right
+         << setw(10) << fixed << setprecision(2) << ms << " ms"
+         << setw(14) << scientific << setprecision(1) << erro << defaultfloat << endl;
+}
+
+int main(int argc, char** argv) {
+    const size_t n = argc > 1 ? stoul(argv[1]) : 1024;
+
+    // ========== USO BÁSICO ==========
+
+    cout << "=== Matriz 3x3 contígua ===" << endl;
+    auto w = Matrix<double>(3, 3, 0.0);   // um único buffer de 9 doubles
+    w(0, 0) = 1.1;                        // linha 0, coluna 0
+    w(1, 1) = 2.2;
+    w(2, 2) = 3.3;
+    for (size_t i = 0; i < w.rows(); i++) {
+        for (size_t j = 0; j < w.cols(); j++) {
+            cout << w(i, j) << "\t";
+        }
+        cout << endl;
+    }
+
+    // O mesmo elemento em posições diferentes do buffer, conforme o layout.
+    cout << "\nPosição de (1, 2) em uma matriz 3x4:" << endl;
+    cout << "  RowMajor: " << RowMajor::index(1, 2, 3, 4) << endl;
+    cout << "  ColMajor: " << ColMajor::index(1, 2, 3, 4) << endl;
+    cout << "  Tiled<2>: " << Tiled<2>::index(1, 2, 3, 4) << endl;
+
+    // ========== BENCHMARK ==========
+
+    cout << "\n=== Matrizes " << n << " x " << n << ", " << thread::hardware_concurrency()
+         << " threads ===" << endl;
+
+    // Os mesmos valores nas duas representações.
+    auto a = Matrix<double>(n, n), b = Matrix<double>(n, n);
+    auto na = Nested(n, vector<double>(n)), nb = Nested(n, vector<double>(n));
+    auto x = vector<double>(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = sin(0.1 * i);
+        for (size_t j = 0; j < n; j++) {
+            a(i, j) = na[i][j] = cos(0.001 * (i * n + j));
+            b(i, j) = nb[i][j] = sin(0.002 * (i + 3 * j));
+        }
+    }
+
+    // (setw conta bytes: "ç", "ã" e "á" ocupam dois)
+    cout << left << setw(20) << "operação" << setw(27) << "versão" << right << setw(13) << "tempo"
+         << setw(15) << "erro máx." << endl;
+
+    // Transposta, em matrizes já alocadas: senão o tempo seria o da alocação
+    // e das faltas de página da primeira escrita.
+    auto nt = Nested(n, vector<double>(n));
+    double ms = medir([&] {
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                nt[j][i] = na[i][j];
+    });
+    linha("transposta", "vector<vector<double>>", ms, 0.0);
+    auto t = Matrix<double>(n, n);
+    ms = medir([&] { transpose(a, t); });
+    double erro = 0;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+            erro = max(erro, abs(t(i, j) - nt[i][j]));
+    linha("transposta", "Matrix (blocos 32x32)", ms, erro);
+
+    // Matriz-vetor
+    vector<double> ny;
+    ms = medir([&] {
+        ny.assign(n, 0.0);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                ny[i] += na[i][j] * x[j];
+    });
+    linha("matriz-vetor", "vector<vector<double>>", ms, 0.0);
+    vector<double> y;
+    ms = medir([&] { y = multiply(a, span<const double>(x)); });
+    erro = 0;
+    for (size_t i = 0; i < n; i++)
+        erro = max(erro, abs(y[i] - ny[i]));
+    linha("matriz-vetor", "Matrix", ms, erro);
+
+    // Matriz-matriz: o laço i-j-k do código que copiou 04_vectors_2d.cpp.
+    Nested nc;
+    ms = medir([&] {
+        nc = Nested(n, vector<double>(n));
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                for (size_t k = 0; k < n; k++)
+                    nc[i][j] += na[i][k] * nb[k][j];
+    });
+    linha("matriz-matriz", "vector<vector<double>>", ms, 0.0);
+
+    auto erroMax = [&](const auto& c) {
+        double e = 0;
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < n; j++)
+                e = max(e, abs(c(i, j) - nc[i][j]));
+        return e;
+    };
+    Matrix<double> c;
+    ms = medir([&] { c = multiply(a, b); });
+    linha("matriz-matriz", "Matrix RowMajor", ms, erroMax(c));
+
+    auto ta = a.as<Tiled<64>>(), tb = b.as<Tiled<64>>();
+    Matrix<double, Tiled<64>> tc;
+    ms = medir([&] { tc = multiply(ta, tb); });
+    linha("matriz-matriz", "Matrix Tiled<64>", ms, erroMax(tc));
+
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Arquivo: matrix.h
+// Tópico: Matriz contígua - um único buffer em vez de vector<vector<T>>
+//
+// vector<vector<double>> (ver 04_vectors_2d.cpp) aloca cada linha
+// separadamente: as linhas ficam espalhadas pelo heap, cada acesso w[i][j]
+// passa por dois ponteiros, e o compilador não consegue vetorizar laços que
+// atravessam linhas. Matrix<T, Layout> guarda os rows x cols elementos em um
+// único buffer alinhado a 64 bytes (uma linha de cache), e o Layout diz em que
+// posição do buffer fica o elemento (i, j), como os layouts de std::mdspan:
+//
+//   RowMajor   linha por linha:   (i, j) -> i * cols + j
+//   ColMajor   coluna por coluna: (i, j) -> j * rows + i
+//   Tiled<B>   blocos B x B, em ordem de linhas, cada bloco contíguo e em
+//              ordem de linhas; as bordas são completadas com zeros
+//
+// MatrixView<T, Layout> é a visão (ponteiro + dimensões) que os kernels
+// recebem, sem posse da memória. Os elementos são copiados byte a byte e
+// nunca destruídos, por isso T deve ser trivialmente copiável.
+//
+// Kernels (em paralelo em todas as threads, com laços internos que o
+// compilador vetoriza com -O3 -march=native). Recebem visões; as formas que
+// recebem Matrix alocam o resultado e chamam o kernel com a.view():
+//
+//   transpose(a, t)      RowMajor, em blocos de 32 x 32 para que leitura e
+//                        escrita fiquem na cache; escreve a transposta em t
+//   multiply(a, x)       matriz-vetor, RowMajor
+//   multiply(a, b, c)    c += a * b, RowMajor (blocos de linhas e de k) ou
+//                        Tiled<B> (produto de blocos contíguos)
+//
+// As dimensões são verificadas com assert (desligado com -DNDEBUG).
+//
+// Compilar com: g++ -std=c++20 -O3 -march=native -pthread
+
+#ifndef _matrix_h
+#define _matrix_h
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// ========== LAYOUTS ==========
+
+struct RowMajor {
+    static size_t size(size_t rows, size_t cols) { return rows * cols; }
+    static size_t index(size_t i, size_t j, size_t, size_t cols) { return i * cols + j; }
+};
+
+struct ColMajor {
+    static size_t size(size_t rows, size_t cols) { return rows * cols; }
+    static size_t index(size_t i, size_t j, size_t rows, size_t) { return j * rows + i; }
+};
+
+template<size_t B>
+struct Tiled {
+    static constexpr size_t tile = B;
+    static size_t tiles(size_t n) { return (n + B - 1) / B; }
+    static size_t size(size_t rows, size_t cols) { return tiles(rows) * tiles(cols) * B * B; }
+    static size_t index(size_t i, size_t j, size_t, size_t cols) {
+        return ((i / B) * tiles(cols) + j / B) * B * B + (i % B) * B + j % B;
+    }
+};
+
+// ========== VISÃO E MATRIZ ==========
+
+template<class T, class Layout = RowMajor>
+struct MatrixView {
+    T* data;
+    size_t rows;
+    size_t cols;
+
+    T& operator()(size_t i, size_t j) const { return data[Layout::index(i, j, rows, cols)]; }
+};
+
+template<class T, class Layout = RowMajor>
+class Matrix {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "o buffer é preenchido e copiado sem construtores nem destrutores");
+
+public:
+    static constexpr size_t alignment = 64;
+
+    Matrix() = default;
+
+    // Matriz rows x cols com todos os elementos iguais a value (inclusive o
+    // preenchimento de Tiled, que fica zero).
+    Matrix(size_t _rows, size_t _cols, T value = T{})
+        : rows_(_rows), cols_(_cols), size_(Layout::size(_rows, _cols)),
+          buffer(static_cast<T*>(::operator new(size_ * sizeof(T), std::align_val_t{alignment}))) {
+        if (size_ == _rows * _cols) {
+            std::fill_n(buffer.get(), size_, value);
+            return;
+        }
+        std::fill_n(buffer.get(), size_, T{});
+        for (size_t i = 0; i < rows_; i++) {
+            for (size_t j = 0; j < cols_; j++) {
+                (*this)(i, j) = value;
+            }
+        }
+    }
+
+    Matrix(const Matrix& o) : Matrix(o.rows_, o.cols_) {
+        std::copy_n(o.data(), size_, data());
+    }
+    Matrix& operator=(const Matrix& o) {
+        Matrix copy(o);
+        std::swap(*this, copy);
+        return *this;
+    }
+    Matrix(Matrix&& o) noexcept
+        : rows_(std::exchange(o.rows_, 0)), cols_(std::exchange(o.cols_, 0)),
+          size_(std::exchange(o.size_, 0)), buffer(std::move(o.buffer)) {}
+    Matrix& operator=(Matrix&& o) noexcept {
+        rows_ = std::exchange(o.rows_, 0);
+        cols_ = std::exchange(o.cols_, 0);
+        size_ = std::exchange(o.size_, 0);
+        buffer = std::move(o.buffer);
+        return *this;
+    }
+
+    // A mesma matriz em outro layout.
+    template<class Other>
+    Matrix<T, Other> as() const {
+        Matrix<T, Other> m(rows_, cols_);
+        for (size_t i = 0; i < rows_; i++) {
+            for (size_t j = 0; j < cols_; j++) {
+                m(i, j) = (*this)(i, j);
+            }
+        }
+        return m;
+    }
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    // Número de elementos do buffer, incluindo o preenchimento.
+    size_t size() const { return size_; }
+    T* data() { return buffer.get(); }
+    const T* data() const { return buffer.get(); }
+
+    T& operator()(size_t i, size_t j) { return buffer[Layout::index(i, j, rows_, cols_)]; }
+    const T& operator()(size_t i, size_t j) const { return buffer[Layout::index(i, j, rows_, cols_)]; }
+
+    MatrixView<T, Layout> view() { return { data(), rows_, cols_ }; }
+    MatrixView<const T, Layout> view() const { return { data(), rows_, cols_ }; }
+
+private:
+    struct AlignedDelete {
+        void operator()(T* p) const { ::operator delete(p, std::align_val_t{alignment}); }
+    };
+
+    size_t rows_ = 0;
+    size_t cols_ = 0;
+    size_t size_ = 0;
+    std::unique_ptr<T[], AlignedDelete> buffer;
+};
+
+// ========== PARALELISMO ==========
+
+// Divide [0, n) em um pedaço contíguo por thread e chama f(first, last) em
+// cada pedaço. Pedaços pequenos demais não compensam criar threads.
+template<class F>
+void parallelChunks(size_t n, F f, size_t minChunk = 1) {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, std::max<size_t>(1, n / minChunk));
+    if (threads == 1) {
+        f(size_t{0}, n);
+        return;
+    }
+    std::vector<std::jthread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([=] { f(n * t / threads, n * (t + 1) / threads); });
+    }
+}
+
+// ========== KERNELS ==========
+
+// Transposta em blocos: um bloco 32 x 32 de a é lido por linhas e escrito
+// por colunas enquanto os dois estão na cache. t deve ser a.cols x a.rows.
+template<class T>
+void transpose(MatrixView<const T> a, MatrixView<T> t) {
+    assert(t.rows == a.cols && t.cols == a.rows);
+    constexpr size_t B = 32;
+    const size_t rows = a.rows, cols = a.cols;
+    const T* src = a.data;
+    T* dst = t.data;
+    parallelChunks((rows + B - 1) / B, [=](size_t first, size_t last) {
+        for (size_t ib = first * B; ib < std::min(rows, last * B); ib += B) {
+            for (size_t jb = 0; jb < cols; jb += B) {
+                for (size_t i = ib; i < std::min(rows, ib + B); i++) {
+                    for (size_t j = jb; j < std::min(cols, jb + B); j++) {
+                        dst[j * rows + i] = src[i * cols + j];
+                    }
+                }
+            }
+        }
+    });
+}
+
+template<class T>
+void transpose(const Matrix<T>& a, Matrix<T>& t) {
+    transpose(a.view(), t.view());
+}
+
+template<class T>
+Matrix<T> transpose(const Matrix<T>& a) {
+    Matrix<T> t(a.cols(), a.rows());
+    transpose(a, t);
+    return t;
+}
+
+// y = a * x. Cada linha é um produto escalar acumulado em 8 somas
+// independentes, que o compilador mantém em um registrador SIMD (uma soma
+// só seria uma cadeia de dependências que ele não pode reordenar).
+template<class T>
+void multiply(MatrixView<const T> a, std::span<const T> x, std::span<T> y) {
+    assert(x.size() == a.cols && y.size() == a.rows);
+    constexpr size_t lanes = 8;
+    const size_t cols = a.cols;
+    const T* m = a.data;
+    const T* v = x.data();
+    T* out = y.data();
+    parallelChunks(a.rows, [=](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            const T* row = m + i * cols;
+            T part[lanes] = {};
+            size_t j = 0;
+            for (; j + lanes <= cols; j += lanes) {
+                for (size_t k = 0; k < lanes; k++) {
+                    part[k] += row[j + k] * v[j + k];
+                }
+            }
+            T sum {};
+            for (; j < cols; j++) {
+                sum += row[j] * v[j];
+            }
+            for (size_t k = 0; k < lanes; k++) {
+                sum += part[k];
+            }
+            out[i] = sum;
+        }
+    }, 64);
+}
+
+template<class T>
+std::vector<T> multiply(const Matrix<T>& a, std::span<const T> x) {
+    std::vector<T> y(a.rows());
+    multiply(a.view(), x, std::span<T>(y));
+    return y;
+}
+
+// c += a * b, RowMajor. A ordem i-k-j percorre as linhas de b e de c de forma
+// contígua (o laço em j é vetorizado), e os blocos de kb linhas de b (kb x
+// jb elementos) são reutilizados por todas as linhas do bloco de a antes de
+// sair da cache.
+template<class T>
+void multiply(MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c) {
+    assert(a.cols == b.rows && c.rows == a.rows && c.cols == b.cols);
+    constexpr size_t ib = 64, kb = 128, jb = 512;
+    const size_t n = a.rows, m = a.cols, p = b.cols;
+    const T* A = a.data;
+    const T* Bm = b.data;
+    T* C = c.data;
+    parallelChunks((n + ib - 1) / ib, [=](size_t first, size_t last) {
+        for (size_t i0 = first * ib; i0 < std::min(n, last * ib); i0 += ib) {
+            for (size_t j0 = 0; j0 < p; j0 += jb) {
+                const size_t j1 = std::min(p, j0 + jb);
+                for (size_t k0 = 0; k0 < m; k0 += kb) {
+                    const size_t k1 = std::min(m, k0 + kb);
+                    for (size_t i = i0; i < std::min(n, i0 + ib); i++) {
+                        T* ci = C + i * p;
+                        for (size_t k = k0; k < k1; k++) {
+                            const T aik = A[i * m + k];
+                            const T* bk = Bm + k * p;
+                            for (size_t j = j0; j < j1; j++) {
+                                ci[j] += aik * bk[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+// c += a * b com blocos B x B contíguos: cada produto de blocos lê e escreve
+// 3 * B * B elementos seguidos, sem bordas (o preenchimento é zero).
+template<class T, size_t B>
+void multiply(MatrixView<const T, Tiled<B>> a, MatrixView<const T, Tiled<B>> b, MatrixView<T, Tiled<B>> c) {
+    assert(a.cols == b.rows && c.rows == a.rows && c.cols == b.cols);
+    using L = Tiled<B>;
+    const size_t ti = L::tiles(a.rows), tk = L::tiles(a.cols), tj = L::tiles(b.cols);
+    const T* A = a.data;
+    const T* Bm = b.data;
+    T* C = c.data;
+    parallelChunks(ti, [=](size_t first, size_t last) {
+        for (size_t I = first; I < last; I++) {
+            for (size_t J = 0; J < tj; J++) {
+                T* cb = C + (I * tj + J) * B * B;
+                for (size_t K = 0; K < tk; K++) {
+                    const T* ab = A + (I * tk + K) * B * B;
+                    const T* bb = Bm + (K * tj + J) * B * B;
+                    for (size_t i = 0; i < B; i++) {
+                        for (size_t k = 0; k < B; k++) {
+                            const T aik = ab[i * B + k];
+                            for (size_t j = 0; j < B; j++) {
+                                cb[i * B + j] += aik * bb[k * B + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+// c = a * b, em uma matriz nova (zerada) no layout de a e b.
+template<class T, class Layout>
+Matrix<T, Layout> multiply(const Matrix<T, Layout>& a, const Matrix<T, Layout>& b) {
+    Matrix<T, Layout> c(a.rows(), b.cols());
+    multiply(a.view(), b.view(), c.view());
+    return c;
+}
+
+#endif //_matrix_h
@@ -7,25 +7,72 @@
 #include <random>
 #include <chrono>
 #include <ranges>
+#include <limits>
+#include <cstdlib>
+#include "perf_counters.h"
+#include "alloc_tracker.h"
+#include "parallel.h"
+#include "bench.h"
+#include "arena.h"
+#include "soa_vector.h"
+#include "simd.h"
+#include "transpose.h"
+#include "philox.h"
+#include "allocator.h"
+#include "column_store.h"
+#include "half.h"
+#include "pipeline.h"
+#include "reduction.h"
+#include "zone_map.h"
 
 using namespace std;
 
-struct Vec3 {
-    float x;
-    float y;
-    float z;
+/* Vec3 and Particle2 are templates over their scalar type only so that
+ * soa_vector can build proxies of references to their fields (see the
+ * GENERIC LAYOUTS section.)
+ */
+template<class F>
+struct BasicVec3 {
+    F x;
+    F y;
+    F z;
 };
 
+using Vec3 = BasicVec3<float>;
+
+/* The initial state of particle i: position, velocity and acceleration
+ * (x, y, z each) and mass, uniform in [0, 10). The values depend only on the
+ * seed of `rng` and on i, so that the initNParticles* functions below can fill
+ * the particles in parallel and in any order, and produce the same particles
+ * for every layout and every number of threads.
+ */
+array<float,10> randomFields( const Philox4x32& rng, size_t i ) {
+    array<float,10> f;
+    for( uint32_t j = 0; j < 3; j++ ) {
+        auto u = rng.uniform4(i, j, 0.f, 10.f);
+        for( uint32_t k = 0; k < 4 && 4*j + k < 10; k++ ) {
+            f[4*j + k] = u[k];
+        }
+    }
+    return f;
+}
+
 
 /// PARTICLES WITH POINTERS ///////////////////////////////////////
 
-struct Particle {
-    shared_ptr<Vec3> position;
-    shared_ptr<Vec3> velocity;
-    shared_ptr<Vec3> accel;
+/* The pointer type is a parameter, so that the same object graph can be
+ * built with reference-counted shared_ptr or with arena handles (see below).
+ */
+template<template<class> class Ptr>
+struct BasicParticle {
+    Ptr<Vec3> position;
+    Ptr<Vec3> velocity;
+    Ptr<Vec3> accel;
     float mass;
 };
 
+using Particle = BasicParticle<shared_ptr>;
+
 shared_ptr<Particle> makeParticle1( mt19937& gen ) {
    uniform_real_distribution<float> dis(0.0, 10.0);
     return make_shared<Particle>(
@@ -37,44 +84,148 @@ shared_ptr<Particle> makeParticle1( mt19937& gen ) {
 }
 
 vector<shared_ptr<Particle>> makeNParticles1( size_t n, mt19937& gen  ) {
+    ALLOC_REGION("makeNParticles1");
     vector<shared_ptr<Particle>> ps(n);
     generate( ps.begin(), ps.end(), [&gen](){ return makeParticle1(gen); });
     return ps;
 }
 
+vector<shared_ptr<Particle>> initNParticles1( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles1");
+    const Philox4x32 rng(seed);
+    vector<shared_ptr<Particle>> ps(n);
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            ps[i] = make_shared<Particle>(
+                make_shared<Vec3>(f[0], f[1], f[2]),
+                make_shared<Vec3>(f[3], f[4], f[5]),
+                make_shared<Vec3>(f[6], f[7], f[8]),
+                f[9]
+            );
+        }
+    });
+    return ps;
+}
+
+/* The same particles, allocated from a monotonic arena instead of the heap:
+ * each particle is immediately followed in memory by its position, velocity
+ * and acceleration, and particle i+1 follows particle i, which is the order
+ * in which the kernels traverse them. Handles are plain pointers, copying one
+ * costs no atomic reference count update.
+ *
+ * ArenaParticles behaves like the vector of shared_ptr for the kernels below
+ * (size() and operator[]), and owns the arenas holding the particles: one for
+ * the serial construction, one per thread for the parallel one.
+ */
+using ArenaParticle = BasicParticle<ArenaPtr>;
+
+struct ArenaParticles {
+    vector<Arena> arenas;
+    vector<ArenaPtr<ArenaParticle>> particles;
+
+    size_t size() const { return particles.size(); }
+    const ArenaPtr<ArenaParticle>& operator[]( size_t i ) const { return particles[i]; }
+};
+
+/* The bytes of arena taken by one particle: its vectors follow it without
+ * padding, but the next particle starts at the alignment of ArenaParticle,
+ * which is exactly the layout of this struct. An arena sized with it holds its
+ * n particles in one block; if it still overflows, the extra blocks are a
+ * small fraction of the first one instead of a second copy.
+ */
+struct ArenaParticleGroup {
+    ArenaParticle particle;
+    Vec3 position, velocity, accel;
+};
+
+constexpr size_t arenaBytesPerParticle = sizeof(ArenaParticleGroup);
+
+Arena makeParticleArena( size_t n ) {
+    const size_t bytes = max<size_t>(n * arenaBytesPerParticle, 4096);
+    return Arena( bytes, max<size_t>(bytes / 64, 4096) );
+}
+
+ArenaParticles makeNParticles1Arena( size_t n, mt19937& gen ) {
+    ALLOC_REGION("makeNParticles1Arena");
+    uniform_real_distribution<float> dis(0.0, 10.0);
+    ArenaParticles ps;
+    Arena& arena = ps.arenas.emplace_back( makeParticleArena(n) );
+    ps.particles.reserve(n);
+    for( size_t i = 0; i < n; i++ ) {
+        // The particle is allocated first, its vectors are filled in afterwards
+        // so that they are placed right behind it.
+        auto p = makeArena<ArenaParticle>(arena);
+        p->position = makeArena<Vec3>(arena, dis(gen), dis(gen), dis(gen));
+        p->velocity = makeArena<Vec3>(arena, dis(gen), dis(gen), dis(gen));
+        p->accel = makeArena<Vec3>(arena, dis(gen), dis(gen), dis(gen));
+        p->mass = dis(gen);
+        ps.particles.push_back(p);
+    }
+    return ps;
+}
+
+/* Each thread allocates its chunk of particles, in order, from its own arena:
+ * the particles of a chunk are contiguous and first touched by the thread that
+ * processes them in the kernels.
+ */
+ArenaParticles initNParticles1Arena( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles1Arena");
+    const Philox4x32 rng(seed);
+    ArenaParticles ps;
+    ps.arenas.resize(numThreads());
+    ps.particles.resize(n);
+    parallelFor(n, [&ps,&rng](size_t first, size_t last, unsigned t) {
+        Arena& arena = ps.arenas[t] = makeParticleArena(last - first);
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            auto p = makeArena<ArenaParticle>(arena);
+            p->position = makeArena<Vec3>(arena, f[0], f[1], f[2]);
+            p->velocity = makeArena<Vec3>(arena, f[3], f[4], f[5]);
+            p->accel = makeArena<Vec3>(arena, f[6], f[7], f[8]);
+            p->mass = f[9];
+            ps.particles[i] = p;
+        }
+    });
+    return ps;
+}
+
+/* The kernels below accept both vector<shared_ptr<Particle>> and
+ * ArenaParticles, and both shared_ptr<Vec3> and ArenaPtr<Vec3>.
+ */
+
 /* Computes the squared norm of a Vec3 */
-inline float norm2( const shared_ptr<Vec3>& v ) {
+inline float norm2( const auto& v ) {
     return powf(v->x,2) + powf(v->y,2) + powf(v->z,2);
 }
 
 /* Computes the kinetic energy of a Single Particule */
-float kineticEnergy( const shared_ptr<Particle> p ) {
+float kineticEnergy( const auto p ) {
     return 0.5f * p->mass * norm2(p->velocity);
 }
 
-/* Computes the total Kinetic energy of many particles */
-float totalKineticEnergy(  const vector<shared_ptr<Particle>>& particles ) {
-    float sum = 0.0;
-    for( size_t i = 0; i < particles.size(); i++ ) {
-        sum += kineticEnergy( particles[i] );
-    }
-    return sum;
+/* Computes the total Kinetic energy of many particles (see reduction.h for
+ * the summation order, which does not depend on the number of threads) */
+float totalKineticEnergy(  const auto& particles ) {
+    PERF_REGION("totalKineticEnergy");
+    return reproducibleSum(particles.size(), [&particles](size_t i) {
+        return kineticEnergy( particles[i] );
+    });
 }
 
 /* Finds the left-most particle among a population */
-float leftMost1( const vector<shared_ptr<Particle>>& particles ) {
-    float minX = particles[1]->position->x;
-    for( size_t i = 0; i < particles.size(); i++ ) {
-        minX = min( minX, particles[i]->position->x);
-    }
-    return minX;
+float leftMost1( const auto& particles ) {
+    PERF_REGION("leftMost1");
+    return reproducibleMin(particles.size(), [&particles](size_t i) {
+        return particles[i]->position->x;
+    });
 }
 
 /* Apply a constant force to a single particule, updating velocity,
  * and position.
  * Here `dt` stands for delta-t, the time increment.
  */
-void applyForce1_(shared_ptr<Particle> p, const Vec3& F, float dt ) {
+void applyForce1_( auto p, const Vec3& F, float dt ) {
     auto m = p->mass;
     p->accel->x += F.x/m;
     p->accel->y += F.y/m;
@@ -88,25 +239,106 @@ void applyForce1_(shared_ptr<Particle> p, const Vec3& F, float dt ) {
 }
 
 /* Applies a constant force to a population of particles (see above.) */
-void applyForce1( vector<shared_ptr<Particle>>& particles,  const Vec3& F, float dt ) {
-    for( size_t i = 0; i < particles.size(); i++ ) {
+void applyForce1( auto& particles,  const Vec3& F, float dt ) {
+    PERF_REGION("applyForce1");
+    parallelFor(particles.size(), [&particles,&F,dt](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            applyForce1_(particles[i], F, dt);
+        }
+    });
+}
+
+/* The same particles as initNParticles1, in a random order: particle i of
+ * the vector is no longer next to particle i+1 in memory, as in a heap that
+ * has been fragmented by a long run of allocations and frees.
+ */
+vector<shared_ptr<Particle>> initNParticles1Shuffled( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles1Shuffled");
+    auto ps = initNParticles1(n, seed);
+    shuffle(ps.begin(), ps.end(), mt19937_64(seed));
+    return ps;
+}
+
+/* Prefetches the three vectors of particle p. Their addresses are in the
+ * particle itself, which must already be in the cache (or on its way), or
+ * reading them stalls as long as the access that is being prefetched.
+ */
+inline void prefetchVectors1( const auto& p ) {
+    __builtin_prefetch(p->position.get(), 1);
+    __builtin_prefetch(p->velocity.get(), 1);
+    __builtin_prefetch(p->accel.get(), 1);
+}
+
+/* applyForce1_ on [first, last) with software prefetching. The hardware
+ * prefetchers cannot follow pointers, so the loop fetches them itself in two
+ * stages: while particle i is updated, particle i + 2 * distance is
+ * prefetched, and the vectors of particle i + distance, whose addresses are
+ * in the particle prefetched `distance` iterations earlier. A distance of 0
+ * prefetches nothing.
+ */
+void applyForce1Prefetched_( auto& particles, size_t first, size_t last,
+                             const Vec3& F, float dt, size_t distance ) {
+    for( size_t i = first; i < last; i++ ) {
+        if( distance > 0 && i + 2*distance < last ) {
+            __builtin_prefetch(particles[i + 2*distance].get(), 1);
+        }
+        if( distance > 0 && i + distance < last ) {
+            prefetchVectors1(particles[i + distance]);
+        }
         applyForce1_(particles[i], F, dt);
     }
 }
 
+void applyForce1Prefetched( auto& particles, const Vec3& F, float dt, size_t distance ) {
+    PERF_REGION("applyForce1Prefetched");
+    parallelFor(particles.size(), [&particles,&F,dt,distance](size_t first, size_t last) {
+        applyForce1Prefetched_(particles, first, last, F, dt, distance);
+    });
+}
+
+/* The prefetch distance that makes applyForce1Prefetched fastest on these
+ * particles, from a short calibration run: three rounds over the candidate
+ * distances, each run on its own slice of 16K particles so that it does not
+ * find the particles left in the cache by the previous run. The force and the
+ * time step are zero, which leaves the particles unchanged.
+ */
+size_t tunePrefetchDistance1( auto& particles ) {
+    const array<size_t, 7> candidates { 0, 2, 4, 8, 16, 32, 64 };
+    const size_t slice = min<size_t>(particles.size(), 1 << 14);
+    const size_t slices = max<size_t>(1, particles.size() / max<size_t>(slice, 1));
+    const Vec3 zero{0.0,0.0,0.0};
+    array<double, candidates.size()> best;
+    best.fill(numeric_limits<double>::infinity());
+    size_t next = 0;
+    for( int round = 0; round < 3; round++ ) {
+        for( size_t c = 0; c < candidates.size(); c++ ) {
+            const size_t first = next++ % slices * slice;
+            auto t0 = chrono::steady_clock::now();
+            applyForce1Prefetched_(particles, first, first + slice, zero, 0.f, candidates[c]);
+            best[c] = min(best[c], chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+        }
+    }
+    return candidates[min_element(best.begin(), best.end()) - best.begin()];
+}
+
 //// WITHOUT VECTORS /////////////////////////////////////////
 
-struct Particle2 {
-    Vec3 position;
-    Vec3 velocity;
-    Vec3 accel;
-    float mass;
+template<class F>
+struct BasicParticle2 {
+    BasicVec3<F> position;
+    BasicVec3<F> velocity;
+    BasicVec3<F> accel;
+    F mass;
 };
 
+using Particle2 = BasicParticle2<float>;
 
-vector<Particle2> makeNParticles2( size_t n, mt19937& gen  ) {
+
+ParticleVector<Particle2> makeNParticles2( size_t n, mt19937& gen  ) {
+    ALLOC_REGION("makeNParticles2");
    uniform_real_distribution<float> dis(0.0, 10.0);
-    vector<Particle2> ps;
+    ParticleVector<Particle2> ps;
+    ps.reserve(n);
     generate_n( back_inserter(ps), n, [&gen,&dis](){
         return Particle2 {
         Vec3 { dis(gen),dis(gen),dis(gen) },
@@ -118,31 +350,45 @@ vector<Particle2> makeNParticles2( size_t n, mt19937& gen  ) {
     return ps;
 }
 
+ParticleVector<Particle2> initNParticles2( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles2");
+    const Philox4x32 rng(seed);
+    ParticleVector<Particle2> ps(n);
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            ps[i] = Particle2 {
+                Vec3 { f[0], f[1], f[2] },
+                Vec3 { f[3], f[4], f[5] },
+                Vec3 { f[6], f[7], f[8] },
+                f[9]
+            };
+        }
+    });
+    return ps;
+}
+
 
 inline float norm2_2( const Vec3& v ) {
-    return powf(v.x,2) + powf(v.y,2) * powf(v.z,2);
+    return v.x*v.x + v.y*v.y + v.z*v.z;
 }
 
 float kineticEnergy2( const Particle2& p ) {
     return 0.5f *  p.mass * norm2_2(p.velocity);
 }
 
-float totalKineticEnergy2(  const vector<Particle2>& particles ) {
-    return transform_reduce(particles.begin(),
-                            particles.end(),
-                            0.f, plus<float>{},
-                            [](auto particle){
-                                return kineticEnergy2(particle);
-                            });
+float totalKineticEnergy2(  const ParticleVector<Particle2>& particles ) {
+    PERF_REGION("totalKineticEnergy2");
+    return reproducibleSum(particles.size(), [&particles](size_t i) {
+        return kineticEnergy2(particles[i]);
+    });
 }
 
-float leftMost2( const vector<Particle2>& particles ) {
-    return transform_reduce(particles.begin(),
-                            particles.end(),
-                            0.f, [](float x, float y){ return min(x,y); },
-                            [](auto particle){
-                                return particle.position.x;
-                            });
+float leftMost2( const ParticleVector<Particle2>& particles ) {
+    PERF_REGION("leftMost2");
+    return reproducibleMin(particles.size(), [&particles](size_t i) {
+        return particles[i].position.x;
+    });
 }
 
 void applyForce2_(Particle2& p, const Vec3& F, float dt ) {
@@ -157,9 +403,12 @@ void applyForce2_(Particle2& p, const Vec3& F, float dt ) {
     p.position.y += p.velocity.y*dt;
     p.position.z += p.velocity.z*dt;
 }
-void applyForce2(vector<Particle2>& particles, const Vec3& F, float dt ) {
-    for_each( particles.begin(), particles.end(), [&F,dt]( auto& p ) {
-        applyForce2_(p,F,dt);
+void applyForce2(ParticleVector<Particle2>& particles, const Vec3& F, float dt ) {
+    PERF_REGION("applyForce2");
+    parallelFor(particles.size(), [&particles,&F,dt](size_t first, size_t last) {
+        for_each( particles.begin() + first, particles.begin() + last, [&F,dt]( auto& p ) {
+            applyForce2_(p,F,dt);
+        });
     });
 }
 
@@ -167,24 +416,26 @@ void applyForce2(vector<Particle2>& particles, const Vec3& F, float dt ) {
 /////////////////////////////////////////////
 
 struct Particles3 {
-    vector<Vec3> position;
-    vector<Vec3> velocity;
-    vector<Vec3> accel;
-    vector<float> mass;
+    ParticleVector<Vec3> position;
+    ParticleVector<Vec3> velocity;
+    ParticleVector<Vec3> accel;
+    ParticleVector<float> mass;
 };
 
-vector<Vec3> makeVectorVec3( size_t n, mt19937& gen ) {
+ParticleVector<Vec3> makeVectorVec3( size_t n, mt19937& gen ) {
    uniform_real_distribution<float> dis(0.0, 10.0);
-   vector<Vec3> vec;
+   ParticleVector<Vec3> vec;
+   vec.reserve(n);
     generate_n( back_inserter(vec), n, [&gen,&dis](){
         return  Vec3 { dis(gen),dis(gen),dis(gen) };
     });
     return vec;
 }
 
-vector<float> makeVectorFloat( size_t n, mt19937& gen ) {
+ParticleVector<float> makeVectorFloat( size_t n, mt19937& gen ) {
    uniform_real_distribution<float> dis(0.0, 10.0);
-   vector<float> vec;
+   ParticleVector<float> vec;
+   vec.reserve(n);
     generate_n( back_inserter(vec), n, [&gen,&dis](){
         return  dis(gen);
     });
@@ -192,6 +443,7 @@ vector<float> makeVectorFloat( size_t n, mt19937& gen ) {
 }
 
 Particles3 makeNParticles3( size_t n, mt19937& gen  ) {
+    ALLOC_REGION("makeNParticles3");
    return Particles3 {
      makeVectorVec3(n, gen),
      makeVectorVec3(n, gen),
@@ -200,29 +452,42 @@ Particles3 makeNParticles3( size_t n, mt19937& gen  ) {
    };
 }
 
+Particles3 initNParticles3( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles3");
+    const Philox4x32 rng(seed);
+    Particles3 ps { ParticleVector<Vec3>(n), ParticleVector<Vec3>(n), ParticleVector<Vec3>(n),
+                    ParticleVector<float>(n) };
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            ps.position[i] = Vec3 { f[0], f[1], f[2] };
+            ps.velocity[i] = Vec3 { f[3], f[4], f[5] };
+            ps.accel[i] = Vec3 { f[6], f[7], f[8] };
+            ps.mass[i] = f[9];
+        }
+    });
+    return ps;
+}
 
-float totalKineticEnergy3(  const Particles3& particles ) {
-    return transform_reduce(particles.velocity.begin(),
-                            particles.velocity.end(),
-                            particles.mass.begin(),
-                            0.f, plus<float>{},
-                            [](auto v, auto m){
-                                return  0.5 *  m * norm2_2(v);
-                            });
 
+float totalKineticEnergy3(  const Particles3& particles ) {
+    PERF_REGION("totalKineticEnergy3");
+    return reproducibleSum(particles.mass.size(), [&particles](size_t i) {
+        return 0.5f * particles.mass[i] * norm2_2(particles.velocity[i]);
+    });
 }
 
 float leftMost3( const Particles3& particles ) {
-    return transform_reduce(particles.position.begin(),
-                            particles.position.end(),
-                            particles.position[0].x, [](float x, float y){ return min(x,y); },
-                            [](auto pos){
-                                return pos.x;
-                            });
+    PERF_REGION("leftMost3");
+    return reproducibleMin(particles.position.size(), [&particles](size_t i) {
+        return particles.position[i].x;
+    });
 }
 
 void applyForce3(Particles3& ps, const Vec3& F, float dt ) {
-    ranges::for_each( views::iota(size_t{},ps.position.size()), [&ps,&F,dt]( auto i ) {
+    PERF_REGION("applyForce3");
+    parallelFor(ps.position.size(), [&ps,&F,dt](size_t first, size_t last) {
+    ranges::for_each( views::iota(first,last), [&ps,&F,dt]( auto i ) {
         auto m = ps.mass[i];
         ps.accel[i].x += F.x/m;
         ps.accel[i].y += F.y/m;
@@ -234,25 +499,27 @@ void applyForce3(Particles3& ps, const Vec3& F, float dt ) {
         ps.position[i].y += ps.velocity[i].y*dt;
         ps.position[i].z += ps.velocity[i].z*dt;
     });
+    });
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 
 struct Particles4 {
-    vector<float> posx;
-    vector<float> posy;
-    vector<float> posz;
-    vector<float> velx;
-    vector<float> vely;
-    vector<float> velz;
-    vector<float> accx;
-    vector<float> accy;
-    vector<float> accz;
-    vector<float> mass;
+    ParticleVector<float> posx;
+    ParticleVector<float> posy;
+    ParticleVector<float> posz;
+    ParticleVector<float> velx;
+    ParticleVector<float> vely;
+    ParticleVector<float> velz;
+    ParticleVector<float> accx;
+    ParticleVector<float> accy;
+    ParticleVector<float> accz;
+    ParticleVector<float> mass;
 };
 
 Particles4 makeNParticles4( size_t n, mt19937& gen  ) {
+    ALLOC_REGION("makeNParticles4");
    return Particles4 {
      makeVectorFloat(n, gen),
      makeVectorFloat(n, gen),
@@ -267,28 +534,45 @@ Particles4 makeNParticles4( size_t n, mt19937& gen  ) {
    };
 }
 
-float totalKineticEnergy4(  const Particles4 particles ) {
-    const size_t n = particles.posx.size();
-    auto es = views::transform(  views::iota(size_t{},n),
-                          [&particles](auto i){
-                              auto v2 = powf(particles.velx[i],2)
-                                  + powf(particles.vely[i],2)
-                                  + powf(particles.velz[i],2);
-                              return 0.5 * particles.mass[i] * v2;
-                          });
-    float eTot = 0.0;
-    ranges::for_each( es, [&eTot]( auto e ){ eTot += e; } );
-    return eTot;
+Particles4 initNParticles4( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles4");
+    const Philox4x32 rng(seed);
+    Particles4 ps;
+    for( auto column : { &ps.posx, &ps.posy, &ps.posz, &ps.velx, &ps.vely, &ps.velz,
+                         &ps.accx, &ps.accy, &ps.accz, &ps.mass } ) {
+        column->resize(n);
+    }
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            ps.posx[i] = f[0]; ps.posy[i] = f[1]; ps.posz[i] = f[2];
+            ps.velx[i] = f[3]; ps.vely[i] = f[4]; ps.velz[i] = f[5];
+            ps.accx[i] = f[6]; ps.accy[i] = f[7]; ps.accz[i] = f[8];
+            ps.mass[i] = f[9];
+        }
+    });
+    return ps;
+}
+
+float totalKineticEnergy4(  const Particles4& particles ) {
+    PERF_REGION("totalKineticEnergy4");
+    const float *velx = particles.velx.data(), *vely = particles.vely.data(), *velz = particles.velz.data();
+    const float* mass = particles.mass.data();
+    return reproducibleSum(particles.posx.size(), [=](size_t i) {
+        return 0.5f * mass[i] * (velx[i]*velx[i] + vely[i]*vely[i] + velz[i]*velz[i]);
+    });
 }
 
 float leftMost4( const Particles4& particles ) {
-    return reduce( particles.posx.begin(), particles.posx.end(),
-                   particles.posx[0],   [](float x, float y){ return min(x,y); });
-
+    PERF_REGION("leftMost4");
+    const float* posx = particles.posx.data();
+    return reproducibleMin(particles.posx.size(), [=](size_t i) { return posx[i]; });
 }
 
 void applyForce4(Particles4& ps, const Vec3& F, float dt ) {
-    ranges::for_each( views::iota(size_t{},ps.posx.size()), [&ps,&F,dt]( auto i ) {
+    PERF_REGION("applyForce4");
+    parallelFor(ps.posx.size(), [&ps,&F,dt](size_t first, size_t last) {
+    ranges::for_each( views::iota(first,last), [&ps,&F,dt]( auto i ) {
         auto m = ps.mass[i];
         ps.accx[i] += F.x/m;
         ps.accy[i] += F.y/m;
@@ -300,66 +584,1198 @@ void applyForce4(Particles4& ps, const Vec3& F, float dt ) {
         ps.posy[i] += ps.vely[i]*dt;
         ps.posz[i] += ps.velz[i]*dt;
     });
+    });
+}
+
+/* `steps` steps of applyForce4 with temporal blocking. The force does not
+ * depend on the other particles, so each particle can be advanced by all the
+ * steps before the next one is touched: the arrays are cut into tiles of
+ * temporalTile particles (20 KB, which stays in L1), and each tile is advanced
+ * `steps` times before moving to the next one. Memory traffic is that of one
+ * step instead of `steps`, and the result is the same as `steps` calls to
+ * applyForce4.
+ */
+constexpr size_t temporalTile = 512;
+
+void applyForceBlocked4( Particles4& ps, const Vec3& F, float dt, int steps ) {
+    PERF_REGION("applyForceBlocked4");
+    float *posx = ps.posx.data(), *posy = ps.posy.data(), *posz = ps.posz.data();
+    float *velx = ps.velx.data(), *vely = ps.vely.data(), *velz = ps.velz.data();
+    float *accx = ps.accx.data(), *accy = ps.accy.data(), *accz = ps.accz.data();
+    const float* mass = ps.mass.data();
+    parallelFor(ps.posx.size(), [=,&F](size_t first, size_t last) {
+        for( size_t tile = first; tile < last; tile += temporalTile ) {
+            size_t end = min(last, tile + temporalTile);
+            for( int s = 0; s < steps; s++ ) {
+                // The arrays do not overlap; without this the compiler gives
+                // up vectorising a loop over ten pointers.
+                #pragma GCC ivdep
+                for( size_t i = tile; i < end; i++ ) {
+                    auto m = mass[i];
+                    accx[i] += F.x/m;
+                    accy[i] += F.y/m;
+                    accz[i] += F.z/m;
+                    velx[i] += accx[i]*dt;
+                    vely[i] += accy[i]*dt;
+                    velz[i] += accz[i]*dt;
+                    posx[i] += velx[i]*dt;
+                    posy[i] += vely[i]*dt;
+                    posz[i] += velz[i]*dt;
+                }
+            }
+        }
+    });
+}
+
+/* Zone maps (see zone_map.h) over the positions and velocities of layout 4.
+ * They pay off on particles kept in spatial order, here sorted along x by
+ * sortByPosX4: a slab in x then touches a few blocks, and the left-most
+ * particle is in the first one.
+ */
+enum ZoneColumn4 : unsigned { ZonePosX, ZonePosY, ZonePosZ, ZoneVelX, ZoneVelY, ZoneVelZ, NumZoneColumns4 };
+
+array<ParticleVector<float>*,NumZoneColumns4> zoneColumns4( Particles4& ps ) {
+    return { &ps.posx, &ps.posy, &ps.posz, &ps.velx, &ps.vely, &ps.velz };
+}
+
+ZoneMap makeZoneMap4( Particles4& ps ) {
+    ZoneMap zones(ps.posx.size(), NumZoneColumns4);
+    auto columns = zoneColumns4(ps);
+    for( unsigned k = 0; k < NumZoneColumns4; k++ ) {
+        zones.summarize(k, columns[k]->data());
+    }
+    return zones;
+}
+
+void sortByPosX4( Particles4& ps ) {
+    const size_t n = ps.posx.size();
+    vector<size_t> order(n);
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&ps](size_t i, size_t j){ return ps.posx[i] < ps.posx[j]; });
+    for( auto column : { &ps.posx, &ps.posy, &ps.posz, &ps.velx, &ps.vely, &ps.velz,
+                         &ps.accx, &ps.accy, &ps.accz, &ps.mass } ) {
+        ParticleVector<float> sorted(n);
+        parallelFor(n, [&](size_t first, size_t last) {
+            for( size_t i = first; i < last; i++ ) {
+                sorted[i] = (*column)[order[i]];
+            }
+        });
+        column->swap(sorted);
+    }
+}
+
+/* applyForce4, keeping the zone map up to date: the threads work on whole
+ * blocks, and each block is summarised right after its update, while it is
+ * still in the cache.
+ */
+void applyForceZoned4( Particles4& ps, ZoneMap& zones, const Vec3& F, float dt ) {
+    PERF_REGION("applyForceZoned4");
+    float *posx = ps.posx.data(), *posy = ps.posy.data(), *posz = ps.posz.data();
+    float *velx = ps.velx.data(), *vely = ps.vely.data(), *velz = ps.velz.data();
+    float *accx = ps.accx.data(), *accy = ps.accy.data(), *accz = ps.accz.data();
+    const float* mass = ps.mass.data();
+    parallelFor(zones.blocks(), [&](size_t first, size_t last) {
+        for( size_t b = first; b < last; b++ ) {
+            auto [begin, end] = zones.blockRange(b);
+            #pragma GCC ivdep
+            for( size_t i = begin; i < end; i++ ) {
+                auto m = mass[i];
+                accx[i] += F.x/m;
+                accy[i] += F.y/m;
+                accz[i] += F.z/m;
+                velx[i] += accx[i]*dt;
+                vely[i] += accy[i]*dt;
+                velz[i] += accz[i]*dt;
+                posx[i] += velx[i]*dt;
+                posy[i] += vely[i]*dt;
+                posz[i] += velz[i]*dt;
+            }
+            const float* columns[] = { posx, posy, posz, velx, vely, velz };
+            for( unsigned k = 0; k < NumZoneColumns4; k++ ) {
+                zones.setZone(k, b, ZoneMap::zoneOf(columns[k] + begin, columns[k] + end));
+            }
+        }
+    });
+}
+
+float leftMostZoned4( const ZoneMap& zones ) {
+    return zones.min(ZonePosX);
+}
+
+/* The number of particles whose position is in the box [lo, hi], by a full
+ * scan and with the zone map.
+ */
+size_t countInBox4( const Particles4& ps, const Vec3& lo, const Vec3& hi ) {
+    PERF_REGION("countInBox4");
+    const float *posx = ps.posx.data(), *posy = ps.posy.data(), *posz = ps.posz.data();
+    return parallelReduce(ps.posx.size(), size_t(0), [=,&lo,&hi](size_t first, size_t last) {
+        size_t count = 0;
+        for( size_t i = first; i < last; i++ ) {
+            count += (posx[i] >= lo.x) & (posx[i] <= hi.x) & (posy[i] >= lo.y) & (posy[i] <= hi.y)
+                   & (posz[i] >= lo.z) & (posz[i] <= hi.z);
+        }
+        return count;
+    }, plus<size_t>{});
+}
+
+size_t countInBoxZoned4( const Particles4& ps, const ZoneMap& zones, const Vec3& lo, const Vec3& hi ) {
+    PERF_REGION("countInBoxZoned4");
+    const float *posx = ps.posx.data(), *posy = ps.posy.data(), *posz = ps.posz.data();
+    vector<pair<size_t,size_t>> partial;
+    size_t whole = 0;
+    zones.forEachCandidate({ { ZonePosX, lo.x, hi.x }, { ZonePosY, lo.y, hi.y }, { ZonePosZ, lo.z, hi.z } },
+                           [&](size_t first, size_t last, bool all) {
+        if( all ) {
+            whole += last - first;
+        }
+        else {
+            partial.emplace_back(first, last);
+        }
+    });
+    return whole + parallelReduce(partial.size(), size_t(0), [&,posx,posy,posz](size_t first, size_t last) {
+        size_t count = 0;
+        for( size_t b = first; b < last; b++ ) {
+            for( size_t i = partial[b].first; i < partial[b].second; i++ ) {
+                count += (posx[i] >= lo.x) & (posx[i] <= hi.x) & (posy[i] >= lo.y) & (posy[i] <= hi.y)
+                       & (posz[i] >= lo.z) & (posz[i] <= hi.z);
+            }
+        }
+        return count;
+    }, plus<size_t>{});
+}
+
+/* A step of the simulation followed by its analysis. Written as three calls it
+ * streams the velocities and posx from memory three times; as a sweep (see
+ * pipeline.h) the update and both reductions run on each tile of particles
+ * while it is in the cache, and every array is read once and written once.
+ * The energy is summed as by totalKineticEnergy4, so that both versions return
+ * the same analysis, bit for bit.
+ */
+struct StepAnalysis {
+    float energy;
+    float leftMost;
+};
+
+StepAnalysis stepAndAnalyse4( Particles4& ps, const Vec3& F, float dt ) {
+    applyForce4(ps, F, dt);
+    return { totalKineticEnergy4(ps), leftMost4(ps) };
+}
+
+StepAnalysis stepAndAnalyse4Fused( Particles4& ps, const Vec3& F, float dt ) {
+    PERF_REGION("stepAndAnalyse4Fused");
+    float *posx = ps.posx.data(), *posy = ps.posy.data(), *posz = ps.posz.data();
+    float *velx = ps.velx.data(), *vely = ps.vely.data(), *velz = ps.velz.data();
+    float *accx = ps.accx.data(), *accy = ps.accy.data(), *accz = ps.accz.data();
+    const float* mass = ps.mass.data();
+    auto [energy, left] = sweep(ps.posx.size())
+        .update([=]( size_t i ) {
+            auto m = mass[i];
+            accx[i] += F.x/m;
+            accy[i] += F.y/m;
+            accz[i] += F.z/m;
+            velx[i] += accx[i]*dt;
+            vely[i] += accy[i]*dt;
+            velz[i] += accz[i]*dt;
+            posx[i] += velx[i]*dt;
+            posy[i] += vely[i]*dt;
+            posz[i] += velz[i]*dt;
+        })
+        .sum([=]( size_t i ) {
+            return 0.5f * mass[i] * (velx[i]*velx[i] + vely[i]*vely[i] + velz[i]*velz[i]);
+        })
+        .reduce(numeric_limits<float>::infinity(), [=]( size_t i ) { return posx[i]; },
+                [](float x, float y){ return min(x,y); })
+        .run();
+    return { energy, left };
+}
+
+
+//// REDUCED PRECISION /////////////////////////////////////////////////////////
+
+/* Layout 4 with the mass and the acceleration stored in 16 bits (Half or
+ * BFloat16, see half.h) and converted to fp32 in the registers. applyForce
+ * moves 58 bytes per particle instead of 76, the kinetic energy 14 instead of
+ * 16. The position and the velocity, which accumulate small increments, stay
+ * in fp32. reportPrecision() measures what the narrow columns cost in
+ * accuracy.
+ */
+template<class Low>
+struct Particles4Low {
+    ParticleVector<float> posx;
+    ParticleVector<float> posy;
+    ParticleVector<float> posz;
+    ParticleVector<float> velx;
+    ParticleVector<float> vely;
+    ParticleVector<float> velz;
+    ParticleVector<Low> accx;
+    ParticleVector<Low> accy;
+    ParticleVector<Low> accz;
+    ParticleVector<Low> mass;
+};
+
+template<class Low>
+Particles4Low<Low> initNParticles4Low( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles4Low");
+    const Philox4x32 rng(seed);
+    Particles4Low<Low> ps;
+    for( auto column : { &ps.posx, &ps.posy, &ps.posz, &ps.velx, &ps.vely, &ps.velz } ) {
+        column->resize(n);
+    }
+    for( auto column : { &ps.accx, &ps.accy, &ps.accz, &ps.mass } ) {
+        column->resize(n);
+    }
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto f = randomFields(rng, i);
+            ps.posx[i] = f[0]; ps.posy[i] = f[1]; ps.posz[i] = f[2];
+            ps.velx[i] = f[3]; ps.vely[i] = f[4]; ps.velz[i] = f[5];
+            ps.accx[i] = Low(f[6]); ps.accy[i] = Low(f[7]); ps.accz[i] = Low(f[8]);
+            ps.mass[i] = Low(f[9]);
+        }
+    });
+    return ps;
+}
+
+template<class Low>
+float totalKineticEnergy4Low( const Particles4Low<Low>& ps ) {
+    PERF_REGION("totalKineticEnergy4Low");
+    const float *velx = ps.velx.data(), *vely = ps.vely.data(), *velz = ps.velz.data();
+    const Low* mass = ps.mass.data();
+    return reproducibleSum(ps.posx.size(), [=](size_t i) {
+        return 0.5f * float(mass[i]) * (velx[i]*velx[i] + vely[i]*vely[i] + velz[i]*velz[i]);
+    });
+}
+
+template<class Low>
+float leftMost4Low( const Particles4Low<Low>& ps ) {
+    PERF_REGION("leftMost4Low");
+    const float* posx = ps.posx.data();
+    return reproducibleMin(ps.posx.size(), [=](size_t i) { return posx[i]; });
+}
+
+template<class Low>
+void applyForce4Low( Particles4Low<Low>& ps, const Vec3& F, float dt ) {
+    PERF_REGION("applyForce4Low");
+    using namespace simd;
+    parallelFor(ps.posx.size(), [&ps,&F,dt](size_t first, size_t last) {
+        const vfloat fx = vset1(F.x), fy = vset1(F.y), fz = vset1(F.z), vdt = vset1(dt);
+        size_t i = first;
+        for( ; i + simdWidth <= last; i += simdWidth ) {
+            vfloat m = vload(&ps.mass[i]);
+            vfloat ax = vadd(vload(&ps.accx[i]), vdiv(fx, m));
+            vfloat ay = vadd(vload(&ps.accy[i]), vdiv(fy, m));
+            vfloat az = vadd(vload(&ps.accz[i]), vdiv(fz, m));
+            vstore(&ps.accx[i], ax);
+            vstore(&ps.accy[i], ay);
+            vstore(&ps.accz[i], az);
+            // The velocity is updated with the acceleration as stored, as in
+            // the scalar loop below.
+            vfloat vx = vfmadd(vload(&ps.accx[i]), vdt, vloadu(&ps.velx[i]));
+            vfloat vy = vfmadd(vload(&ps.accy[i]), vdt, vloadu(&ps.vely[i]));
+            vfloat vz = vfmadd(vload(&ps.accz[i]), vdt, vloadu(&ps.velz[i]));
+            vstoreu(&ps.velx[i], vx);
+            vstoreu(&ps.vely[i], vy);
+            vstoreu(&ps.velz[i], vz);
+            vstoreu(&ps.posx[i], vfmadd(vx, vdt, vloadu(&ps.posx[i])));
+            vstoreu(&ps.posy[i], vfmadd(vy, vdt, vloadu(&ps.posy[i])));
+            vstoreu(&ps.posz[i], vfmadd(vz, vdt, vloadu(&ps.posz[i])));
+        }
+        for( ; i < last; i++ ) {
+            float m = ps.mass[i];
+            ps.accx[i] = Low(ps.accx[i] + F.x/m);
+            ps.accy[i] = Low(ps.accy[i] + F.y/m);
+            ps.accz[i] = Low(ps.accz[i] + F.z/m);
+            ps.velx[i] += ps.accx[i]*dt;
+            ps.vely[i] += ps.accy[i]*dt;
+            ps.velz[i] += ps.accz[i]*dt;
+            ps.posx[i] += ps.velx[i]*dt;
+            ps.posy[i] += ps.vely[i]*dt;
+            ps.posz[i] += ps.velz[i]*dt;
+        }
+    });
+}
+
+/* Runs `steps` steps of applyForce on n particles in fp32 (layout 4) and with
+ * narrow columns, and prints the normwise relative error of the positions and
+ * velocities (largest difference over largest fp32 value), the relative error
+ * of the kinetic energy, and the number of particles whose acceleration
+ * overflowed the narrow type (F/m grows without bound for small masses, and
+ * fp16 stops at 65504). The errors are computed over the other particles.
+ */
+template<class Low>
+void reportPrecision( const string& layout, size_t n, int steps ) {
+    const Vec3 F{0.0,0.0,-9.81};
+    const float dt {0.01};
+    auto exact = initNParticles4(n, 1);
+    auto narrow = initNParticles4Low<Low>(n, 1);
+    for( int s = 0; s < steps; s++ ) {
+        applyForce4(exact, F, dt);
+        applyForce4Low(narrow, F, dt);
+    }
+    double posDiff = 0, posMax = 0, velDiff = 0, velMax = 0, energy = 0, narrowEnergy = 0;
+    size_t overflows = 0;
+    for( size_t i = 0; i < n; i++ ) {
+        if( !isfinite(float(narrow.accz[i])) ) {
+            overflows++;
+            continue;
+        }
+        posDiff = max({ posDiff, (double)abs(narrow.posx[i] - exact.posx[i]),
+                        (double)abs(narrow.posy[i] - exact.posy[i]), (double)abs(narrow.posz[i] - exact.posz[i]) });
+        posMax = max({ posMax, (double)abs(exact.posx[i]), (double)abs(exact.posy[i]), (double)abs(exact.posz[i]) });
+        velDiff = max({ velDiff, (double)abs(narrow.velx[i] - exact.velx[i]),
+                        (double)abs(narrow.vely[i] - exact.vely[i]), (double)abs(narrow.velz[i] - exact.velz[i]) });
+        velMax = max({ velMax, (double)abs(exact.velx[i]), (double)abs(exact.vely[i]), (double)abs(exact.velz[i]) });
+        energy += 0.5 * exact.mass[i] * (exact.velx[i]*exact.velx[i] + exact.vely[i]*exact.vely[i]
+                                         + exact.velz[i]*exact.velz[i]);
+        narrowEnergy += 0.5 * narrow.mass[i] * (narrow.velx[i]*narrow.velx[i] + narrow.vely[i]*narrow.vely[i]
+                                                + narrow.velz[i]*narrow.velz[i]);
+    }
+    // No particle, or only overflowed ones, means no error rather than 0/0.
+    auto relative = [](double diff, double ref) { return ref > 0 ? diff / ref : 0.0; };
+    cout << layout << " vs 4-SoA, n=" << n << ", " << steps << " steps: relative error position "
+         << relative(posDiff, posMax) << ", velocity " << relative(velDiff, velMax)
+         << ", kinetic energy " << relative(abs(narrowEnergy - energy), energy)
+         << ", overflowed particles " << overflows << "\n";
+}
+
+
+//// TILED (AoSoA) ////////////////////////////////////////////////////////////
+
+/* Particles are grouped in blocks of simdWidth (8 with AVX2, 16 with
+ * AVX-512), and within a block every field is an aligned array that fills
+ * exactly one SIMD register. A kernel touching k fields reads k short
+ * contiguous runs per block, all from one memory stream, and the arithmetic
+ * maps one-to-one onto vector instructions.
+ *
+ * The last block may be partially filled: the kernels process its `n %
+ * simdWidth` particles with scalar code and never read the padding.
+ */
+using simd::simdWidth;
+
+struct alignas(64) ParticleBlock5 {
+    float posx[simdWidth];
+    float posy[simdWidth];
+    float posz[simdWidth];
+    float velx[simdWidth];
+    float vely[simdWidth];
+    float velz[simdWidth];
+    float accx[simdWidth];
+    float accy[simdWidth];
+    float accz[simdWidth];
+    float mass[simdWidth];
+};
+
+struct Particles5 {
+    size_t n;
+    ParticleVector<ParticleBlock5> blocks;
+
+    size_t size() const { return n; }
+    size_t fullBlocks() const { return n / simdWidth; }
+};
+
+/* Draws the fields column after column, like makeNParticles4, so that both
+ * layouts hold the same particles for the same generator state.
+ */
+Particles5 makeNParticles5( size_t n, mt19937& gen ) {
+    ALLOC_REGION("makeNParticles5");
+    uniform_real_distribution<float> dis(0.0, 10.0);
+    Particles5 ps { n, ParticleVector<ParticleBlock5>((n + simdWidth - 1) / simdWidth) };
+    for( auto field : { &ParticleBlock5::posx, &ParticleBlock5::posy, &ParticleBlock5::posz,
+                        &ParticleBlock5::velx, &ParticleBlock5::vely, &ParticleBlock5::velz,
+                        &ParticleBlock5::accx, &ParticleBlock5::accy, &ParticleBlock5::accz,
+                        &ParticleBlock5::mass } ) {
+        for( size_t i = 0; i < n; i++ ) {
+            (ps.blocks[i / simdWidth].*field)[i % simdWidth] = dis(gen);
+        }
+    }
+    return ps;
+}
+
+/* The blocks are partitioned between the threads like in the kernels. */
+Particles5 initNParticles5( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles5");
+    const Philox4x32 rng(seed);
+    Particles5 ps { n, ParticleVector<ParticleBlock5>((n + simdWidth - 1) / simdWidth) };
+    parallelFor(ps.blocks.size(), [&ps,&rng](size_t first, size_t last) {
+        for( size_t b = first; b < last; b++ ) {
+            ParticleBlock5& blk = ps.blocks[b];
+            for( size_t k = 0; k < simdWidth; k++ ) {
+                size_t i = b * simdWidth + k;
+                // The padding of the last block gets harmless values.
+                auto f = i < ps.n ? randomFields(rng, i) : array<float,10>{ 0,0,0, 0,0,0, 0,0,0, 1 };
+                blk.posx[k] = f[0]; blk.posy[k] = f[1]; blk.posz[k] = f[2];
+                blk.velx[k] = f[3]; blk.vely[k] = f[4]; blk.velz[k] = f[5];
+                blk.accx[k] = f[6]; blk.accy[k] = f[7]; blk.accz[k] = f[8];
+                blk.mass[k] = f[9];
+            }
+        }
+    });
+    return ps;
+}
+
+/* The energies of a block are computed together, with the expression of
+ * layout 4, and added to the lanes of reproducibleSumLanes that the same
+ * particles take in the other layouts: the energy is the same, bit for bit,
+ * whatever the layout and the number of threads.
+ */
+float totalKineticEnergy5( const Particles5& ps ) {
+    PERF_REGION("totalKineticEnergy5");
+    static_assert( sumLanes % simdWidth == 0, "a block must not straddle the lanes" );
+    const ParticleBlock5* blocks = ps.blocks.data();
+    return reproducibleSumLanes(ps.n, [=](size_t first, size_t last, double* lane) {
+        for( size_t i = first; i < last; i += simdWidth ) {
+            const ParticleBlock5& blk = blocks[i / simdWidth];
+            float e[simdWidth];
+            for( size_t k = 0; k < simdWidth; k++ ) {
+                e[k] = 0.5f * blk.mass[k] * (blk.velx[k]*blk.velx[k] + blk.vely[k]*blk.vely[k] + blk.velz[k]*blk.velz[k]);
+            }
+            double* part = lane + i % sumLanes;
+            if( i + simdWidth <= last ) {
+                for( size_t k = 0; k < simdWidth; k++ ) part[k] += e[k];
+            } else {
+                for( size_t k = 0; k < last - i; k++ ) part[k] += e[k];
+            }
+        }
+    });
+}
+
+float leftMost5( const Particles5& ps ) {
+    PERF_REGION("leftMost5");
+    using namespace simd;
+    auto minimum = [](float x, float y){ return min(x,y); };
+    float minX = parallelReduce(ps.fullBlocks(), INFINITY, [&ps](size_t first, size_t last) {
+        vfloat m = vset1(INFINITY);
+        for( size_t b = first; b < last; b++ ) {
+            m = vmin(m, vload(ps.blocks[b].posx));
+        }
+        return hmin(m);
+    }, minimum);
+    for( size_t i = ps.fullBlocks() * simdWidth; i < ps.n; i++ ) {
+        minX = min(minX, ps.blocks.back().posx[i % simdWidth]);
+    }
+    return minX;
+}
+
+void applyForce5( Particles5& ps, const Vec3& F, float dt ) {
+    PERF_REGION("applyForce5");
+    using namespace simd;
+    parallelFor(ps.fullBlocks(), [&ps,&F,dt](size_t first, size_t last) {
+        const vfloat fx = vset1(F.x), fy = vset1(F.y), fz = vset1(F.z), vdt = vset1(dt);
+        for( size_t b = first; b < last; b++ ) {
+            ParticleBlock5& blk = ps.blocks[b];
+            vfloat m = vload(blk.mass);
+            vfloat ax = vadd(vload(blk.accx), vdiv(fx, m));
+            vfloat ay = vadd(vload(blk.accy), vdiv(fy, m));
+            vfloat az = vadd(vload(blk.accz), vdiv(fz, m));
+            vfloat vx = vfmadd(ax, vdt, vload(blk.velx));
+            vfloat vy = vfmadd(ay, vdt, vload(blk.vely));
+            vfloat vz = vfmadd(az, vdt, vload(blk.velz));
+            vstore(blk.accx, ax);
+            vstore(blk.accy, ay);
+            vstore(blk.accz, az);
+            vstore(blk.velx, vx);
+            vstore(blk.vely, vy);
+            vstore(blk.velz, vz);
+            vstore(blk.posx, vfmadd(vx, vdt, vload(blk.posx)));
+            vstore(blk.posy, vfmadd(vy, vdt, vload(blk.posy)));
+            vstore(blk.posz, vfmadd(vz, vdt, vload(blk.posz)));
+        }
+    });
+    for( size_t i = ps.fullBlocks() * simdWidth; i < ps.n; i++ ) {
+        ParticleBlock5& blk = ps.blocks.back();
+        size_t k = i % simdWidth;
+        auto m = blk.mass[k];
+        blk.accx[k] += F.x/m;
+        blk.accy[k] += F.y/m;
+        blk.accz[k] += F.z/m;
+        blk.velx[k] += blk.accx[k]*dt;
+        blk.vely[k] += blk.accy[k]*dt;
+        blk.velz[k] += blk.accz[k]*dt;
+        blk.posx[k] += blk.velx[k]*dt;
+        blk.posy[k] += blk.vely[k]*dt;
+        blk.posz[k] += blk.velz[k]*dt;
+    }
+}
+
+
+/* `steps` steps of applyForce5 with temporal blocking at the register level:
+ * a block is loaded once, advanced `steps` times in the SIMD registers, and
+ * stored once.
+ */
+void applyForceBlocked5( Particles5& ps, const Vec3& F, float dt, int steps ) {
+    PERF_REGION("applyForceBlocked5");
+    using namespace simd;
+    parallelFor(ps.fullBlocks(), [&ps,&F,dt,steps](size_t first, size_t last) {
+        const vfloat fx = vset1(F.x), fy = vset1(F.y), fz = vset1(F.z), vdt = vset1(dt);
+        for( size_t b = first; b < last; b++ ) {
+            ParticleBlock5& blk = ps.blocks[b];
+            vfloat m = vload(blk.mass);
+            vfloat ax = vload(blk.accx), ay = vload(blk.accy), az = vload(blk.accz);
+            vfloat vx = vload(blk.velx), vy = vload(blk.vely), vz = vload(blk.velz);
+            vfloat px = vload(blk.posx), py = vload(blk.posy), pz = vload(blk.posz);
+            for( int s = 0; s < steps; s++ ) {
+                ax = vadd(ax, vdiv(fx, m));
+                ay = vadd(ay, vdiv(fy, m));
+                az = vadd(az, vdiv(fz, m));
+                vx = vfmadd(ax, vdt, vx);
+                vy = vfmadd(ay, vdt, vy);
+                vz = vfmadd(az, vdt, vz);
+                px = vfmadd(vx, vdt, px);
+                py = vfmadd(vy, vdt, py);
+                pz = vfmadd(vz, vdt, pz);
+            }
+            vstore(blk.accx, ax);
+            vstore(blk.accy, ay);
+            vstore(blk.accz, az);
+            vstore(blk.velx, vx);
+            vstore(blk.vely, vy);
+            vstore(blk.velz, vz);
+            vstore(blk.posx, px);
+            vstore(blk.posy, py);
+            vstore(blk.posz, pz);
+        }
+    });
+    for( size_t i = ps.fullBlocks() * simdWidth; i < ps.n; i++ ) {
+        ParticleBlock5& blk = ps.blocks.back();
+        size_t k = i % simdWidth;
+        auto m = blk.mass[k];
+        for( int s = 0; s < steps; s++ ) {
+            blk.accx[k] += F.x/m;
+            blk.accy[k] += F.y/m;
+            blk.accz[k] += F.z/m;
+            blk.velx[k] += blk.accx[k]*dt;
+            blk.vely[k] += blk.accy[k]*dt;
+            blk.velz[k] += blk.accz[k]*dt;
+            blk.posx[k] += blk.velx[k]*dt;
+            blk.posy[k] += blk.vely[k]*dt;
+            blk.posz[k] += blk.velz[k]*dt;
+        }
+    }
+}
+
+
+//// LAYOUT CONVERSIONS ////////////////////////////////////////////////////////
+
+/* Conversions between layouts 2 to 5, for particles that arrive in one layout
+ * (records read from a file are AoS) and are processed in another.
+ *
+ * readBlock and writeBlock give the simdWidth particles of block b of a layout
+ * as 10 registers, one per field in the order of Particle2. The records of
+ * layout 2, and the Vec3 of layout 3, are transposed in registers (see
+ * transpose.h); the columns of layout 4 and the blocks of layout 5 already
+ * hold one register per field. convertLayout copies the blocks in parallel and
+ * the last `n % simdWidth` particles one at a time, with getParticle and
+ * setParticle.
+ *
+ * With `stream`, the destination is written with non-temporal stores: when
+ * the particles do not fit in the caches, the converted data is evicted before
+ * anyone reads it, and the stores no longer read each line before writing it.
+ */
+using Fields = simd::vfloat[10];
+
+constexpr array<float (ParticleBlock5::*)[simdWidth], 10> fields5 {
+    &ParticleBlock5::posx, &ParticleBlock5::posy, &ParticleBlock5::posz,
+    &ParticleBlock5::velx, &ParticleBlock5::vely, &ParticleBlock5::velz,
+    &ParticleBlock5::accx, &ParticleBlock5::accy, &ParticleBlock5::accz,
+    &ParticleBlock5::mass
+};
+
+auto columns4( auto& ps ) {
+    return array { ps.posx.data(), ps.posy.data(), ps.posz.data(), ps.velx.data(), ps.vely.data(),
+                   ps.velz.data(), ps.accx.data(), ps.accy.data(), ps.accz.data(), ps.mass.data() };
+}
+
+size_t particleCount( const ParticleVector<Particle2>& ps ) { return ps.size(); }
+size_t particleCount( const Particles3& ps ) { return ps.mass.size(); }
+size_t particleCount( const Particles4& ps ) { return ps.mass.size(); }
+size_t particleCount( const Particles5& ps ) { return ps.n; }
+
+/* Room for n particles, not initialised: the pages are touched first by the
+ * threads of the conversion that fills them.
+ */
+template<class P>
+P allocateParticles( size_t n );
+
+template<>
+ParticleVector<Particle2> allocateParticles( size_t n ) {
+    return ParticleVector<Particle2>(n);
+}
+
+template<>
+Particles3 allocateParticles( size_t n ) {
+    return Particles3 { ParticleVector<Vec3>(n), ParticleVector<Vec3>(n), ParticleVector<Vec3>(n),
+                        ParticleVector<float>(n) };
+}
+
+template<>
+Particles4 allocateParticles( size_t n ) {
+    Particles4 ps;
+    for( auto column : { &ps.posx, &ps.posy, &ps.posz, &ps.velx, &ps.vely, &ps.velz,
+                         &ps.accx, &ps.accy, &ps.accz, &ps.mass } ) {
+        column->resize(n);
+    }
+    return ps;
+}
+
+template<>
+Particles5 allocateParticles( size_t n ) {
+    return Particles5 { n, ParticleVector<ParticleBlock5>((n + simdWidth - 1) / simdWidth) };
+}
+
+array<float,10> getParticle( const ParticleVector<Particle2>& ps, size_t i ) {
+    return bit_cast<array<float,10>>(ps[i]);
+}
+
+void setParticle( ParticleVector<Particle2>& ps, size_t i, const array<float,10>& f ) {
+    ps[i] = bit_cast<Particle2>(f);
+}
+
+array<float,10> getParticle( const Particles3& ps, size_t i ) {
+    const Vec3 &p = ps.position[i], &v = ps.velocity[i], &a = ps.accel[i];
+    return { p.x, p.y, p.z, v.x, v.y, v.z, a.x, a.y, a.z, ps.mass[i] };
+}
+
+void setParticle( Particles3& ps, size_t i, const array<float,10>& f ) {
+    ps.position[i] = Vec3 { f[0], f[1], f[2] };
+    ps.velocity[i] = Vec3 { f[3], f[4], f[5] };
+    ps.accel[i] = Vec3 { f[6], f[7], f[8] };
+    ps.mass[i] = f[9];
+}
+
+array<float,10> getParticle( const Particles4& ps, size_t i ) {
+    array<float,10> f;
+    auto columns = columns4(ps);
+    for( size_t k = 0; k < 10; k++ ) f[k] = columns[k][i];
+    return f;
+}
+
+void setParticle( Particles4& ps, size_t i, const array<float,10>& f ) {
+    auto columns = columns4(ps);
+    for( size_t k = 0; k < 10; k++ ) columns[k][i] = f[k];
+}
+
+array<float,10> getParticle( const Particles5& ps, size_t i ) {
+    array<float,10> f;
+    for( size_t k = 0; k < 10; k++ ) f[k] = (ps.blocks[i / simdWidth].*fields5[k])[i % simdWidth];
+    return f;
+}
+
+void setParticle( Particles5& ps, size_t i, const array<float,10>& f ) {
+    for( size_t k = 0; k < 10; k++ ) (ps.blocks[i / simdWidth].*fields5[k])[i % simdWidth] = f[k];
+}
+
+void readBlock( const ParticleVector<Particle2>& ps, size_t b, Fields& f ) {
+    simd::loadRecords<10>(reinterpret_cast<const float*>(ps.data() + b*simdWidth), f);
+}
+
+void writeBlock( ParticleVector<Particle2>& ps, size_t b, const Fields& f, bool stream ) {
+    simd::storeRecords<10>(reinterpret_cast<float*>(ps.data() + b*simdWidth), f, stream);
+}
+
+void readBlock( const Particles3& ps, size_t b, Fields& f ) {
+    simd::vfloat xyz[3];
+    for( auto [vec, k] : { pair{&ps.position, 0}, pair{&ps.velocity, 3}, pair{&ps.accel, 6} } ) {
+        simd::loadRecords<3>(reinterpret_cast<const float*>(vec->data() + b*simdWidth), xyz);
+        copy_n(xyz, 3, f + k);
+    }
+    f[9] = simd::vloadu(ps.mass.data() + b*simdWidth);
+}
+
+void writeBlock( Particles3& ps, size_t b, const Fields& f, bool stream ) {
+    for( auto [vec, k] : { pair{&ps.position, 0}, pair{&ps.velocity, 3}, pair{&ps.accel, 6} } ) {
+        const simd::vfloat xyz[3] = { f[k], f[k+1], f[k+2] };
+        simd::storeRecords<3>(reinterpret_cast<float*>(vec->data() + b*simdWidth), xyz, stream);
+    }
+    simd::vstoreTo(ps.mass.data() + b*simdWidth, f[9], stream);
+}
+
+void readBlock( const Particles4& ps, size_t b, Fields& f ) {
+    auto columns = columns4(ps);
+    for( size_t k = 0; k < 10; k++ ) f[k] = simd::vloadu(columns[k] + b*simdWidth);
+}
+
+void writeBlock( Particles4& ps, size_t b, const Fields& f, bool stream ) {
+    auto columns = columns4(ps);
+    for( size_t k = 0; k < 10; k++ ) simd::vstoreTo(columns[k] + b*simdWidth, f[k], stream);
+}
+
+void readBlock( const Particles5& ps, size_t b, Fields& f ) {
+    for( size_t k = 0; k < 10; k++ ) f[k] = simd::vload(ps.blocks[b].*fields5[k]);
+}
+
+void writeBlock( Particles5& ps, size_t b, const Fields& f, bool stream ) {
+    for( size_t k = 0; k < 10; k++ ) simd::vstoreTo(ps.blocks[b].*fields5[k], f[k], stream);
+}
+
+/* dst, which holds as many particles as src, gets the particles of src. */
+template<class Src, class Dst>
+void convertLayout( const Src& src, Dst& dst, bool stream = false ) {
+    PERF_REGION("convertLayout");
+    const size_t n = particleCount(src);
+    parallelFor(n / simdWidth, [&src,&dst,stream](size_t first, size_t last) {
+        Fields f;
+        for( size_t b = first; b < last; b++ ) {
+            readBlock(src, b, f);
+            writeBlock(dst, b, f, stream);
+        }
+        simd::vfence();
+    });
+    for( size_t i = n / simdWidth * simdWidth; i < n; i++ ) {
+        setParticle(dst, i, getParticle(src, i));
+    }
+}
+
+template<class Dst, class Src>
+Dst convertLayout( const Src& src, bool stream = false ) {
+    Dst dst = allocateParticles<Dst>(particleCount(src));
+    convertLayout(src, dst, stream);
+    return dst;
+}
+
+/* The same conversion one particle at a time, as a baseline. */
+template<class Src, class Dst>
+void convertLayoutScalar( const Src& src, Dst& dst ) {
+    PERF_REGION("convertLayoutScalar");
+    parallelFor(particleCount(src), [&src,&dst](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            setParticle(dst, i, getParticle(src, i));
+        }
+    });
+}
+
+/* In place between records and blocks, in the memory of a Particles5: a block
+ * has the size of simdWidth Particle2, so records read into ps.blocks as they
+ * come (with fread from a file of Particle2, for instance) become the blocks
+ * of layout 5, and back before writing them out. The padding of the last block
+ * is converted with it.
+ */
+static_assert( sizeof(ParticleBlock5) == simdWidth * sizeof(Particle2) );
+
+void recordsToBlocks5( Particles5& ps ) {
+    PERF_REGION("recordsToBlocks5");
+    float* data = reinterpret_cast<float*>(ps.blocks.data());
+    parallelFor(ps.blocks.size(), [data](size_t first, size_t last) {
+        for( size_t b = first; b < last; b++ ) {
+            simd::recordsToRows<10>(data + b * 10 * simdWidth);
+        }
+    });
+}
+
+void blocksToRecords5( Particles5& ps ) {
+    PERF_REGION("blocksToRecords5");
+    float* data = reinterpret_cast<float*>(ps.blocks.data());
+    parallelFor(ps.blocks.size(), [data](size_t first, size_t last) {
+        for( size_t b = first; b < last; b++ ) {
+            simd::rowsToRecords<10>(data + b * 10 * simdWidth);
+        }
+    });
+}
+
+
+//// OUT-OF-CORE ///////////////////////////////////////////////////////////////
+
+/* The columns of layout 4 kept in a memory-mapped file (see column_store.h),
+ * for particle sets that do not fit in memory. The kernels are those of layout
+ * 4, applied chunk by chunk while the next chunks are read from the disk.
+ *
+ * The file is created in the directory given by the PARTICLE_DIR environment
+ * variable, /tmp by default, and deleted with the particles.
+ */
+enum Column6 : unsigned { PosX, PosY, PosZ, VelX, VelY, VelZ, AccX, AccY, AccZ, Mass, NumColumns6 };
+
+struct Particles6 {
+    ColumnStore store;
+
+    size_t size() const { return store.size(); }
+    float* operator[]( Column6 k ) { return store.column(k); }
+    const float* operator[]( Column6 k ) const { return store.column(k); }
+};
+
+Particles6 initNParticles6( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticles6");
+    const char* dir = getenv("PARTICLE_DIR");
+    string path = string(dir ? dir : "/tmp") + "/particles6." + to_string(getpid());
+    Particles6 ps { ColumnStore(path, NumColumns6, n, true) };
+    const Philox4x32 rng(seed);
+    ps.store.stream({}, { PosX, PosY, PosZ, VelX, VelY, VelZ, AccX, AccY, AccZ, Mass },
+                    [&ps,&rng](size_t first, size_t last) {
+        parallelFor(last - first, [&ps,&rng,first](size_t begin, size_t end) {
+            for( size_t i = first + begin; i < first + end; i++ ) {
+                auto f = randomFields(rng, i);
+                for( unsigned k = 0; k < NumColumns6; k++ ) {
+                    ps[Column6(k)][i] = f[k];
+                }
+            }
+        });
+    });
+    return ps;
+}
+
+/* Each chunk is summed by reproducibleSumDouble and the chunk sums are added
+ * in double, in chunk order: the result does not depend on the number of
+ * threads.
+ */
+float totalKineticEnergy6( Particles6& ps ) {
+    PERF_REGION("totalKineticEnergy6");
+    const float *velx = ps[VelX], *vely = ps[VelY], *velz = ps[VelZ], *mass = ps[Mass];
+    double eTot = 0.0;
+    ps.store.stream({ VelX, VelY, VelZ, Mass }, {}, [&](size_t first, size_t last) {
+        eTot += reproducibleSumDouble(last - first, [=](size_t i) {
+            const size_t j = first + i;
+            return 0.5f * mass[j] * (velx[j]*velx[j] + vely[j]*vely[j] + velz[j]*velz[j]);
+        });
+    });
+    return float(eTot);
+}
+
+float leftMost6( Particles6& ps ) {
+    PERF_REGION("leftMost6");
+    const float* posx = ps[PosX];
+    float left = numeric_limits<float>::infinity();
+    auto minimum = [](float x, float y){ return min(x,y); };
+    ps.store.stream({ PosX }, {}, [&](size_t first, size_t last) {
+        left = min(left, parallelReduce(last - first, left, [&](size_t begin, size_t end) {
+            return reduce(posx + first + begin, posx + first + end, left, minimum);
+        }, minimum));
+    });
+    return left;
+}
+
+void applyForce6( Particles6& ps, const Vec3& F, float dt ) {
+    PERF_REGION("applyForce6");
+    float *posx = ps[PosX], *posy = ps[PosY], *posz = ps[PosZ];
+    float *velx = ps[VelX], *vely = ps[VelY], *velz = ps[VelZ];
+    float *accx = ps[AccX], *accy = ps[AccY], *accz = ps[AccZ];
+    const float* mass = ps[Mass];
+    ps.store.stream({ Mass }, { PosX, PosY, PosZ, VelX, VelY, VelZ, AccX, AccY, AccZ },
+                    [&](size_t first, size_t last) {
+        parallelFor(last - first, [&](size_t begin, size_t end) {
+            for( size_t i = first + begin; i < first + end; i++ ) {
+                auto m = mass[i];
+                accx[i] += F.x/m;
+                accy[i] += F.y/m;
+                accz[i] += F.z/m;
+                velx[i] += accx[i]*dt;
+                vely[i] += accy[i]*dt;
+                velz[i] += accz[i]*dt;
+                posx[i] += velx[i]*dt;
+                posy[i] += vely[i]*dt;
+                posz[i] += velz[i]*dt;
+            }
+        });
+    });
+}
+
+
+//// GENERIC LAYOUTS ///////////////////////////////////////////////////////////
+
+/* The kernels are written once against soa_vector<Particle2, Layout>, which
+ * stores the particles as AoS, SoA or AoSoA depending on its Layout
+ * parameter. A new attribute in BasicParticle2 needs no new code here.
+ */
+template<class Layout>
+using ParticlesV = soa_vector<Particle2, Layout>;
+
+template<class Layout>
+ParticlesV<Layout> makeNParticlesV( size_t n, mt19937& gen ) {
+    ALLOC_REGION("makeNParticlesV");
+   uniform_real_distribution<float> dis(0.0, 10.0);
+   ParticlesV<Layout> ps(n);
+   for( size_t i = 0; i < n; i++ ) {
+       ps.set(i, Particle2 {
+           Vec3 { dis(gen),dis(gen),dis(gen) },
+           Vec3 { dis(gen),dis(gen),dis(gen) },
+           Vec3 { dis(gen),dis(gen),dis(gen) },
+           dis(gen)
+       });
+   }
+   return ps;
+}
+
+template<class Layout>
+ParticlesV<Layout> initNParticlesV( size_t n, uint64_t seed ) {
+    ALLOC_REGION("initNParticlesV");
+    const Philox4x32 rng(seed);
+    auto ps = ParticlesV<Layout>::for_overwrite(n);
+    parallelFor(n, [&ps,&rng](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            ps.set(i, bit_cast<Particle2>(randomFields(rng, i)));
+        }
+    });
+    return ps;
+}
+
+template<class Layout>
+float totalKineticEnergyV( const ParticlesV<Layout>& ps ) {
+    PERF_REGION("totalKineticEnergyV");
+    return reproducibleSum(ps.size(), [&ps](size_t i) {
+        auto&& p = ps[i];
+        return 0.5f * p.mass * (p.velocity.x*p.velocity.x + p.velocity.y*p.velocity.y
+                                + p.velocity.z*p.velocity.z);
+    });
+}
+
+template<class Layout>
+float leftMostV( const ParticlesV<Layout>& ps ) {
+    PERF_REGION("leftMostV");
+    return reproducibleMin(ps.size(), [&ps](size_t i) { return ps[i].position.x; });
+}
+
+template<class Layout>
+void applyForceV( ParticlesV<Layout>& ps, const Vec3& F, float dt ) {
+    PERF_REGION("applyForceV");
+    parallelFor(ps.size(), [&ps,&F,dt](size_t first, size_t last) {
+        for( size_t i = first; i < last; i++ ) {
+            auto&& p = ps[i];
+            auto m = p.mass;
+            p.accel.x += F.x/m;
+            p.accel.y += F.y/m;
+            p.accel.z += F.z/m;
+            p.velocity.x += p.accel.x*dt;
+            p.velocity.y += p.accel.y*dt;
+            p.velocity.z += p.accel.z*dt;
+            p.position.x += p.velocity.x*dt;
+            p.position.y += p.velocity.y*dt;
+            p.position.z += p.velocity.z*dt;
+        }
+    });
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 
-int main() {
-    const size_t N { 100000000 };
-    std::mt19937 gen{1};
+// Useful bytes (read + written) and flops per particle of each kernel, the
+// same for all layouts: construction writes 10 floats, applyForce reads 10
+// floats and writes 9, the kinetic energy reads the velocity and the mass,
+// leftMost reads one coordinate.
+const KernelInfo constructInfo { "construct", 40, 0 };
+const KernelInfo applyForceInfo { "applyForce", 76, 18 };
+const KernelInfo kineticEnergyInfo { "totalKineticEnergy", 16, 8 };
+const KernelInfo leftMostInfo { "leftMost", 4, 1 };
+const KernelInfo boxQueryInfo { "countInBox", 12, 6 };
+const KernelInfo analysisStepInfo { "applyForce+analysis", 96, 27 };
+
+/* Runs the three kernels of a layout for every size of the configuration. The
+ * particles are built in parallel by the initNParticles* functions, with the
+ * same seed for every layout, so all layouts start from the same particles.
+ * A time step must not allocate: built with -DALLOC_TRACKING, allocations in
+ * applyForce are reported as violations (see alloc_tracker.h).
+ */
+void benchLayout( Benchmark& bench, const string& layout, auto make,
+                  auto applyForce, auto kineticEnergy, auto leftMost ) {
+    if( !bench.wantsLayout(layout) ) {
+        return;
+    }
     const Vec3 F{0.0,0.0,-9.81};
     const float dt {0.01};
-    {
-    auto ps1 = makeNParticles1(N, gen);
-    cout << "PS1[4].velocity.x=" << (ps1[4]->velocity->x) << endl;
-    auto t0 = chrono::high_resolution_clock::now();
-    //auto e1 = totalKineticEnergy(ps1);
-    //auto e1 = leftMost1(ps1);
-    applyForce1(ps1,F,dt);
-    auto e1 = 0;
-    auto t1 = chrono::high_resolution_clock::now();
-    long long dt = std::chrono::duration_cast<chrono::milliseconds>(t1-t0).count();
-    cout << "E1: " << e1 << "  duration: " << dt << " ms" << endl;
+    const uint64_t seed {1};
+    const string step = "applyForce " + layout;
+    for( size_t n : bench.cfg().sizes ) {
+        bench.run(constructInfo, layout, n, [&]{
+            auto ps = make(n, seed);
+            doNotOptimize(&ps);
+        });
+        auto ps = make(n, seed);
+        bench.run(applyForceInfo, layout, n, [&]{
+            ALLOC_FORBID(step);
+            applyForce(ps,F,dt);
+        });
+        bench.run(kineticEnergyInfo, layout, n, [&]{ doNotOptimize(kineticEnergy(ps)); });
+        bench.run(leftMostInfo, layout, n, [&]{ doNotOptimize(leftMost(ps)); });
     }
-    {
-    auto ps2 = makeNParticles2(N, gen);
-    cout << "PS2[4].velocity.x=" << (ps2[4].velocity.x) << endl;
-    auto t2 = chrono::high_resolution_clock::now();
-    //auto e2 = totalKineticEnergy2(ps2);
-    //auto e2 = leftMost2(ps2);
-    applyForce2(ps2,F,dt);
-    auto e2 = 0;
-    auto t3 = chrono::high_resolution_clock::now();
-    long long dt = std::chrono::duration_cast<chrono::milliseconds>(t3-t2).count();
-    cout << "E2: " << e2 << "  duration: " << dt << " ms" << endl;
-    }{
-        auto ps3 = makeNParticles3(N, gen);
-    cout << "PS3[4].velocity.x=" << (ps3.velocity[4].x) << endl;
-    auto t4 = chrono::high_resolution_clock::now();
-    //auto e3 = totalKineticEnergy3(ps3);
-    //auto e3 = leftMost3(ps3);
-    applyForce3(ps3,F,dt);
-    auto e3 = 0;
-    auto t5 = chrono::high_resolution_clock::now();
-    long long dt = std::chrono::duration_cast<chrono::milliseconds>(t5-t4).count();
-    cout << "E3: " << e3 << "  duration: " << dt << " ms" << endl;
-    }{
-        auto ps4 = makeNParticles4(N, gen);
-    cout << "PS4[4].velocity.x=" << (ps4.velx[4]) << endl;
-    auto t6 = chrono::high_resolution_clock::now();
-    //auto e4 = totalKineticEnergy4(ps4);
-    //auto e4 = leftMost4(ps4);
-    applyForce4(ps4,F,dt);
-    auto e4 = 0;
-    auto t7 = chrono::high_resolution_clock::now();
-    long long dt = std::chrono::duration_cast<chrono::milliseconds>(t7-t6).count();
-    cout << "E4: " << e4 << "  duration: " << dt << " ms" << endl;
+}
+
+/* `steps` steps of applyForce as `steps` sweeps and with temporal blocking, on
+ * layouts 4 and 5, for each K of --time-steps. Bytes and flops are those of
+ * the K steps, so GB/s is the bandwidth that K separate sweeps would need.
+ */
+void benchTemporalBlocking( Benchmark& bench ) {
+    const Vec3 F{0.0,0.0,-9.81};
+    const float dt {0.01};
+    for( int steps : bench.cfg().timeSteps ) {
+        const KernelInfo info { "applyForce*" + to_string(steps), 76.0 * steps, 18.0 * steps };
+        for( size_t n : bench.cfg().sizes ) {
+            if( bench.wants(info.name, "4-SoA") || bench.wants(info.name, "4-SoA-tblock") ) {
+                auto ps = initNParticles4(n, 1);
+                bench.run(info, "4-SoA", n, [&]{
+                    for( int s = 0; s < steps; s++ ) applyForce4(ps,F,dt);
+                });
+                bench.run(info, "4-SoA-tblock", n, [&]{ applyForceBlocked4(ps,F,dt,steps); });
+            }
+            if( bench.wants(info.name, "5-AoSoA") || bench.wants(info.name, "5-AoSoA-tblock") ) {
+                auto ps = initNParticles5(n, 1);
+                bench.run(info, "5-AoSoA", n, [&]{
+                    for( int s = 0; s < steps; s++ ) applyForce5(ps,F,dt);
+                });
+                bench.run(info, "5-AoSoA-tblock", n, [&]{ applyForceBlocked5(ps,F,dt,steps); });
+            }
+        }
     }
+}
 
+/* Queries on particles sorted along x, by full scans ("4-SoA-sorted") and with
+ * a zone map ("4-SoA-zoned"), and the cost of keeping the map up to date in
+ * applyForce. The box is a slab of 1% of the domain in x.
+ */
+void benchZoneMaps( Benchmark& bench ) {
+    const Vec3 F{0.0,0.0,-9.81};
+    const float dt {0.01};
+    const Vec3 lo{4.0,2.0,0.0}, hi{4.1,8.0,10.0};
+    if( !bench.wantsLayout("4-SoA-sorted") && !bench.wantsLayout("4-SoA-zoned") ) {
+        return;
+    }
+    for( size_t n : bench.cfg().sizes ) {
+        auto ps = initNParticles4(n, 1);
+        sortByPosX4(ps);
+        auto zones = makeZoneMap4(ps);
+        bench.run(leftMostInfo, "4-SoA-sorted", n, [&]{ doNotOptimize(leftMost4(ps)); });
+        bench.run(leftMostInfo, "4-SoA-zoned", n, [&]{ doNotOptimize(leftMostZoned4(zones)); });
+        bench.run(boxQueryInfo, "4-SoA-sorted", n, [&]{ doNotOptimize(countInBox4(ps,lo,hi)); });
+        bench.run(boxQueryInfo, "4-SoA-zoned", n, [&]{ doNotOptimize(countInBoxZoned4(ps,zones,lo,hi)); });
+        bench.run(applyForceInfo, "4-SoA-sorted", n, [&]{ applyForce4(ps,F,dt); });
+        bench.run(applyForceInfo, "4-SoA-zoned", n, [&]{ applyForceZoned4(ps,zones,F,dt); });
+    }
+}
 
+/* applyForce on the pointer layouts with the prefetch distance tuned for
+ * each set of particles, and on particles in random order in memory, without
+ * and with prefetching.
+ */
+void benchPrefetch( Benchmark& bench ) {
+    const Vec3 F{0.0,0.0,-9.81};
+    const float dt {0.01};
+    auto run = [&]( const string& layout, auto make, bool prefetch ) {
+        if( !bench.wants(applyForceInfo.name, layout) ) {
+            return;
+        }
+        for( size_t n : bench.cfg().sizes ) {
+            auto ps = make(n, 1);
+            if( !prefetch ) {
+                bench.run(applyForceInfo, layout, n, [&]{ applyForce1(ps,F,dt); });
+                continue;
+            }
+            const size_t distance = tunePrefetchDistance1(ps);
+            cout << "# " << layout << " n=" << n << ": prefetch distance " << distance << endl;
+            bench.run(applyForceInfo, layout, n, [&]{ applyForce1Prefetched(ps,F,dt,distance); });
+        }
+    };
+    run("1-pointers-pf", initNParticles1, true);
+    run("1-arena-pf", initNParticles1Arena, true);
+    run("1-shuffled", initNParticles1Shuffled, false);
+    run("1-shuffled-pf", initNParticles1Shuffled, true);
+}
 
+/* A step and its analysis on layout 4, in three passes and fused. */
+void benchAnalysisStep( Benchmark& bench ) {
+    const Vec3 F{0.0,0.0,-9.81};
+    const float dt {0.01};
+    if( !bench.wants(analysisStepInfo.name, "4-SoA") && !bench.wants(analysisStepInfo.name, "4-SoA-fused") ) {
+        return;
+    }
+    for( size_t n : bench.cfg().sizes ) {
+        auto ps = initNParticles4(n, 1);
+        bench.run(analysisStepInfo, "4-SoA", n, [&]{ doNotOptimize(stepAndAnalyse4(ps,F,dt)); });
+        bench.run(analysisStepInfo, "4-SoA-fused", n, [&]{ doNotOptimize(stepAndAnalyse4Fused(ps,F,dt)); });
+    }
+}
 
+/* Conversions into particles allocated beforehand. The layout names the source
+ * and the destination ("2>4" is AoS to SoA); "-scalar" copies one particle at
+ * a time, "-stream" writes with non-temporal stores. "5<>2-inplace" turns
+ * layout 5 into records and back in place, the bytes of two conversions.
+ */
+const KernelInfo convertInfo { "convert", 80, 0 };
+const KernelInfo convertInPlaceInfo { "convert*2", 160, 0 };
 
+void benchConversions( Benchmark& bench ) {
+    auto wantsAny = [&]( initializer_list<const char*> layouts ) {
+        return any_of(layouts.begin(), layouts.end(), [&](const char* layout) {
+            return bench.wants(convertInfo.name, layout) || bench.wants(convertInPlaceInfo.name, layout);
+        });
+    };
+    for( size_t n : bench.cfg().sizes ) {
+        auto convert = [&]( const string& layout, const auto& src, auto dst, bool stream ) {
+            if( !bench.wants(convertInfo.name, layout) ) {
+                return;
+            }
+            dst = allocateParticles<decltype(dst)>(n);
+            bench.run(convertInfo, layout, n, [&]{ convertLayout(src, dst, stream); });
+        };
+        if( wantsAny({ "2>3", "2>4", "2>4-stream", "2>4-scalar", "2>5" }) ) {
+            auto ps = initNParticles2(n, 1);
+            convert("2>3", ps, Particles3{}, false);
+            convert("2>4", ps, Particles4{}, false);
+            convert("2>4-stream", ps, Particles4{}, true);
+            convert("2>5", ps, Particles5{}, false);
+            if( bench.wants(convertInfo.name, "2>4-scalar") ) {
+                auto dst = allocateParticles<Particles4>(n);
+                bench.run(convertInfo, "2>4-scalar", n, [&]{ convertLayoutScalar(ps, dst); });
+            }
+        }
+        if( wantsAny({ "3>4" }) ) {
+            auto ps = initNParticles3(n, 1);
+            convert("3>4", ps, Particles4{}, false);
+        }
+        if( wantsAny({ "4>2", "4>5" }) ) {
+            auto ps = initNParticles4(n, 1);
+            convert("4>2", ps, ParticleVector<Particle2>{}, false);
+            convert("4>5", ps, Particles5{}, false);
+        }
+        if( wantsAny({ "5>2", "5<>2-inplace" }) ) {
+            auto ps = initNParticles5(n, 1);
+            convert("5>2", ps, ParticleVector<Particle2>{}, false);
+            bench.run(convertInPlaceInfo, "5<>2-inplace", n, [&]{
+                blocksToRecords5(ps);
+                recordsToBlocks5(ps);
+            });
+        }
+    }
+}
 
+/* Benchmarks every kernel on every layout. Build with
+ *   g++ -std=c++20 -O3 -march=native SOA.cpp -o soa
+ * and run e.g. `./soa --sizes 1e3,1e6,1e8 --threads 1,0 --csv soa.csv`
+ * (see bench.h for all the options). Layout 6 keeps its particles in a file in
+ * $PARTICLE_DIR (default /tmp), and can hold more particles than the RAM.
+ */
+int main( int argc, char* argv[] ) {
+    Benchmark bench( BenchConfig::fromArgs(argc, argv) );
+    using Particles1 = vector<shared_ptr<Particle>>;
+    benchLayout(bench, "1-pointers", initNParticles1, applyForce1<Particles1>,
+                totalKineticEnergy<Particles1>, leftMost1<Particles1>);
+    benchLayout(bench, "1-arena", initNParticles1Arena, applyForce1<ArenaParticles>,
+                totalKineticEnergy<ArenaParticles>, leftMost1<ArenaParticles>);
+    benchLayout(bench, "2-AoS", initNParticles2, applyForce2, totalKineticEnergy2, leftMost2);
+    benchLayout(bench, "3-SoA-Vec3", initNParticles3, applyForce3, totalKineticEnergy3, leftMost3);
+    benchLayout(bench, "4-SoA", initNParticles4, applyForce4, totalKineticEnergy4, leftMost4);
+    benchLayout(bench, "4-SoA-fp16", initNParticles4Low<Half>, applyForce4Low<Half>,
+                totalKineticEnergy4Low<Half>, leftMost4Low<Half>);
+    benchLayout(bench, "4-SoA-bf16", initNParticles4Low<BFloat16>, applyForce4Low<BFloat16>,
+                totalKineticEnergy4Low<BFloat16>, leftMost4Low<BFloat16>);
+    benchLayout(bench, "5-AoSoA", initNParticles5, applyForce5, totalKineticEnergy5, leftMost5);
+    benchLayout(bench, "6-mmap", initNParticles6, applyForce6, totalKineticEnergy6, leftMost6);
+    benchLayout(bench, "V-AoS", initNParticlesV<AoS>, applyForceV<AoS>,
+                totalKineticEnergyV<AoS>, leftMostV<AoS>);
+    benchLayout(bench, "V-SoA", initNParticlesV<SoA>, applyForceV<SoA>,
+                totalKineticEnergyV<SoA>, leftMostV<SoA>);
+    benchLayout(bench, "V-AoSoA16", initNParticlesV<AoSoA<16>>, applyForceV<AoSoA<16>>,
+                totalKineticEnergyV<AoSoA<16>>, leftMostV<AoSoA<16>>);
+    benchPrefetch(bench);
+    benchAnalysisStep(bench);
+    benchConversions(bench);
+    benchTemporalBlocking(bench);
+    benchZoneMaps(bench);
+    const size_t precisionN = min<size_t>(bench.cfg().sizes.back(), 1'000'000);
+    if( bench.wantsLayout("4-SoA-fp16") ) {
+        reportPrecision<Half>("4-SoA-fp16", precisionN, 100);
+    }
+    if( bench.wantsLayout("4-SoA-bf16") ) {
+        reportPrecision<BFloat16>("4-SoA-bf16", precisionN, 100);
+    }
+    bench.finish();
+    PERF_REPORT();
+    if( alloc::violations() > 0 ) {
+        cerr << alloc::violations() << " allocations in time steps (see alloc_tracker.h)" << endl;
+        return 1;
+    }
 }
@@ -0,0 +1,416 @@
+#ifndef _alloc_tracker_h
+#define _alloc_tracker_h
+
+// Heap allocations per code region: allocations and releases, bytes
+// allocated, peak live bytes, and reallocations with the bytes they copied.
+//
+// Compile with -DALLOC_TRACKING to enable. Without it, the ALLOC_REGION,
+// ALLOC_FORBID and ALLOC_REPORT macros expand to nothing and operator new is
+// left alone.
+//
+//   ALLOC_REGION("makeNParticles2");  // attributes the enclosing block
+//   ALLOC_FORBID("applyForce");       // the same, and every allocation in the
+//                                     // block is a violation
+//   ALLOC_REPORT();                   // prints the table (also done at exit)
+//
+// With ALLOC_TRACKING this header replaces the global operator new and delete,
+// so exactly one translation unit of the program may include it (each program
+// of this module is a single one). The arrays that HugePageAllocator maps with
+// mmap do not go through operator new: it reports them with
+// alloc::recordAllocation and alloc::recordRelease.
+//
+// An allocation is attributed to the innermost region open on its thread.
+// The workers of parallelFor run each task in the innermost region of the
+// thread that called parallelFor, which ThreadPool hands to them with
+// alloc::context() and alloc::Adopt. Other threads without a region of their
+// own, such as those of the standard parallel algorithms, count for the
+// innermost region of the main thread (the one that initialised the tracker),
+// which is the one that started them. A background thread that should not be
+// charged to the main thread opens its own region. Allocations outside every
+// region go to "(none)".
+//
+// Live bytes are the bytes allocated and not released yet, as malloc reserved
+// them (malloc_usable_size). The peak of a region is the largest number of
+// live bytes of the process while the region was open, which includes what was
+// already live when it was entered.
+//
+// A reallocation is an allocation followed, on the same thread and before any
+// other allocation, by the release of a smaller block: this is how a
+// std::vector grows, copying its old block into the new one. The copied bytes
+// are the size of the old block.
+//
+// The other instrumentation layers may be nested in a forbidden region: the
+// regions of perf_counters.h do not allocate when they are entered and left,
+// so -DPERF_COUNTERS -DALLOC_TRACKING reports the kernels alone.
+//
+// At exit the table is printed on stderr and, if $ALLOC_TRACKING_CSV names a
+// file, written to it as CSV. With $ALLOC_TRACKING_ABORT set, the first
+// violation aborts the program, so that a debugger shows where it allocates;
+// otherwise alloc::violations() lets main() fail after the run.
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#ifdef ALLOC_TRACKING
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <malloc.h>
+
+namespace alloc {
+
+struct RegionStats {
+  std::string name;
+  bool forbidden = false;
+  uint64_t calls = 0;
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> releases{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> peakBytes{0};
+  std::atomic<uint64_t> reallocations{0};
+  std::atomic<uint64_t> copiedBytes{0};
+  std::atomic<uint64_t> violations{0};
+};
+
+namespace detail {
+
+constexpr size_t maxRegions = 256;
+constexpr size_t maxDepth = 32;
+
+// Constant-initialised, so that operator new works before main and after the
+// destructors of the other globals.
+inline RegionStats* regions[maxRegions];
+inline std::atomic<size_t> numRegions{0};
+inline std::mutex mutex;
+// The regions of the main thread, which only the main thread pushes and pops
+// and the other threads read, and the regions of the other threads.
+inline std::atomic<RegionStats*> open[maxDepth];
+inline std::atomic<size_t> depth{0};
+inline std::atomic<std::thread::id> owner;
+inline thread_local RegionStats* threadOpen[maxDepth];
+inline thread_local size_t threadDepth = 0;
+// The region handed to this thread by the thread pool for the current task.
+inline thread_local RegionStats* adopted = nullptr;
+inline std::atomic<uint64_t> live{0};
+inline std::atomic<uint64_t> peak{0};
+
+// Set while the tracker itself allocates (region names, report).
+inline thread_local bool suspended = false;
+// Bytes of the last allocation of this thread, until the next release.
+inline thread_local uint64_t lastAllocation = 0;
+
+struct Suspend {
+  bool previous = std::exchange(suspended, true);
+  ~Suspend() { suspended = previous; }
+};
+
+inline void raise(std::atomic<uint64_t>& x, uint64_t value) {
+  uint64_t current = x.load(std::memory_order_relaxed);
+  while (current < value && !x.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+inline RegionStats& none() {
+  static RegionStats* stats = [] {
+    Suspend suspend;
+    auto* s = new RegionStats;
+    s->name = "(none)";
+    regions[numRegions++] = s;
+    return s;
+  }();
+  return *stats;
+}
+
+// Whether this thread owns the main stack. The first thread to ask claims it;
+// exitReport asks during the static initialisation, on the main thread.
+inline bool isOwner() {
+  const std::thread::id self = std::this_thread::get_id();
+  std::thread::id current{};
+  return owner.compare_exchange_strong(current, self) || current == self;
+}
+
+inline RegionStats& innermost() {
+  if (threadDepth > 0) {
+    return *threadOpen[threadDepth - 1];
+  }
+  if (adopted) {
+    return *adopted;
+  }
+  size_t d = depth.load(std::memory_order_acquire);
+  return d == 0 ? none() : *open[d - 1].load(std::memory_order_relaxed);
+}
+
+// The stats of the region `name`, created on first use.
+inline RegionStats& stats(std::string_view name, bool forbidden) {
+  Suspend suspend;
+  none();
+  std::lock_guard lock(mutex);
+  for (size_t i = 0; i < numRegions; ++i) {
+    if (regions[i]->name == name && regions[i]->forbidden == forbidden) return *regions[i];
+  }
+  if (numRegions == maxRegions) {
+    return none();
+  }
+  auto* s = new RegionStats;
+  s->name = name;
+  s->forbidden = forbidden;
+  regions[numRegions++] = s;
+  return *s;
+}
+
+} // namespace detail
+
+inline void recordAllocation(size_t bytes) {
+  using namespace detail;
+  if (suspended) {
+    return;
+  }
+  const uint64_t now = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  raise(peak, now);
+  const size_t d = depth.load(std::memory_order_acquire);
+  for (size_t i = 0; i < d; ++i) {
+    raise(open[i].load(std::memory_order_relaxed)->peakBytes, now);
+  }
+  for (size_t i = 0; i < threadDepth; ++i) {
+    raise(threadOpen[i]->peakBytes, now);
+  }
+  if (adopted) {
+    raise(adopted->peakBytes, now);
+  }
+  RegionStats& s = innermost();
+  s.allocations.fetch_add(1, std::memory_order_relaxed);
+  s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  lastAllocation = bytes;
+  if (s.forbidden) {
+    s.violations.fetch_add(1, std::memory_order_relaxed);
+    if (std::getenv("ALLOC_TRACKING_ABORT")) std::abort();
+  }
+}
+
+inline void recordRelease(size_t bytes) {
+  using namespace detail;
+  if (suspended) {
+    return;
+  }
+  live.fetch_sub(bytes, std::memory_order_relaxed);
+  RegionStats& s = innermost();
+  s.releases.fetch_add(1, std::memory_order_relaxed);
+  if (lastAllocation > bytes) {
+    s.reallocations.fetch_add(1, std::memory_order_relaxed);
+    s.copiedBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  lastAllocation = 0;
+}
+
+// Allocations made in ALLOC_FORBID regions so far.
+inline uint64_t violations() {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < detail::numRegions; ++i) sum += detail::regions[i]->violations;
+  return sum;
+}
+
+inline void report(std::ostream& os) {
+  using namespace detail;
+  Suspend suspend;
+  std::lock_guard lock(mutex);
+  auto mb = [](uint64_t bytes) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << bytes * 1e-6;
+    return ss.str();
+  };
+  os << std::left << std::setw(28) << "region" << std::right << std::setw(8) << "calls"
+     << std::setw(12) << "allocs" << std::setw(12) << "frees" << std::setw(12) << "MB alloc"
+     << std::setw(11) << "peak MB" << std::setw(10) << "reallocs" << std::setw(11) << "copied MB"
+     << std::setw(11) << "violations" << "\n";
+  for (size_t i = 0; i < numRegions; ++i) {
+    const RegionStats& s = *regions[i];
+    if (s.calls == 0 && s.allocations == 0 && s.releases == 0) {
+      continue;
+    }
+    os << std::left << std::setw(28) << (s.forbidden ? "!" : "") + s.name << std::right
+       << std::setw(8) << s.calls << std::setw(12) << s.allocations << std::setw(12) << s.releases
+       << std::setw(12) << mb(s.bytes) << std::setw(11) << mb(s.peakBytes)
+       << std::setw(10) << s.reallocations << std::setw(11) << mb(s.copiedBytes)
+       << std::setw(11) << s.violations << "\n";
+  }
+  os << "Peak live heap: " << mb(peak) << " MB; '!' marks the regions where allocating is a violation.\n";
+}
+
+inline void writeCsv(const std::string& fname) {
+  using namespace detail;
+  Suspend suspend;
+  std::lock_guard lock(mutex);
+  std::ofstream out(fname);
+  out << "region,forbidden,calls,allocations,releases,bytes,peak_bytes,reallocations,copied_bytes,violations\n";
+  for (size_t i = 0; i < numRegions; ++i) {
+    const RegionStats& s = *regions[i];
+    out << s.name << "," << s.forbidden << "," << s.calls << "," << s.allocations << "," << s.releases
+        << "," << s.bytes << "," << s.peakBytes << "," << s.reallocations << "," << s.copiedBytes
+        << "," << s.violations << "\n";
+  }
+}
+
+// The innermost region of the calling thread, to hand to the threads that
+// work on its behalf.
+using Context = RegionStats*;
+
+inline Context context() {
+  return &detail::innermost();
+}
+
+// Runs its block in the region `context` of another thread, unless the block
+// opens regions of its own.
+class Adopt {
+public:
+  explicit Adopt(Context context): previous(std::exchange(detail::adopted, context)) {}
+  ~Adopt() { detail::adopted = previous; }
+
+  Adopt(const Adopt&) = delete;
+  Adopt& operator=(const Adopt&) = delete;
+
+private:
+  Context previous;
+};
+
+// Makes its block the innermost region until it is destroyed.
+class Region {
+public:
+  Region(std::string_view name, bool forbidden = false) {
+    using namespace detail;
+    RegionStats& s = stats(name, forbidden);
+    ++s.calls;
+    raise(s.peakBytes, live.load(std::memory_order_relaxed));
+    if (isOwner()) {
+      // Only this thread changes depth, the other ones only read it.
+      const size_t d = depth.load(std::memory_order_relaxed);
+      if (d < maxDepth) {
+        open[d].store(&s, std::memory_order_relaxed);
+        depth.store(d + 1, std::memory_order_release);
+        pushed = &depth;
+      }
+    }
+    else if (threadDepth < maxDepth) {
+      threadOpen[threadDepth++] = &s;
+      pushed = &threadDepth;
+    }
+  }
+
+  ~Region() {
+    using namespace detail;
+    if (pushed == &depth) {
+      depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+    else if (pushed == &threadDepth) {
+      --threadDepth;
+    }
+  }
+
+  Region(const Region&) = delete;
+  Region& operator=(const Region&) = delete;
+
+private:
+  // The stack the region was pushed on, if it was not full.
+  const void* pushed = nullptr;
+};
+
+namespace detail {
+
+// Claims the main stack for the main thread, and prints the report when the
+// program exits.
+struct ExitReport {
+  ExitReport() { isOwner(); }
+  ~ExitReport() {
+    report(std::cerr);
+    if (const char* fname = std::getenv("ALLOC_TRACKING_CSV")) writeCsv(fname);
+  }
+};
+
+inline ExitReport exitReport;
+
+inline void* allocate(size_t n, size_t alignment, bool nothrow) {
+  void* p = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    p = std::malloc(n ? n : 1);
+  }
+  else if (posix_memalign(&p, alignment, n ? n : 1) != 0) {
+    p = nullptr;
+  }
+  if (!p) {
+    if (nothrow) return nullptr;
+    throw std::bad_alloc();
+  }
+  recordAllocation(malloc_usable_size(p));
+  return p;
+}
+
+inline void release(void* p) {
+  if (p) {
+    recordRelease(malloc_usable_size(p));
+    std::free(p);
+  }
+}
+
+} // namespace detail
+} // namespace alloc
+
+void* operator new(size_t n) { return alloc::detail::allocate(n, 0, false); }
+void* operator new[](size_t n) { return alloc::detail::allocate(n, 0, false); }
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return alloc::detail::allocate(n, 0, true); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return alloc::detail::allocate(n, 0, true); }
+void* operator new(size_t n, std::align_val_t a) { return alloc::detail::allocate(n, size_t(a), false); }
+void* operator new[](size_t n, std::align_val_t a) { return alloc::detail::allocate(n, size_t(a), false); }
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+  return alloc::detail::allocate(n, size_t(a), true);
+}
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+  return alloc::detail::allocate(n, size_t(a), true);
+}
+void operator delete(void* p) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p) noexcept { alloc::detail::release(p); }
+void operator delete(void* p, size_t) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p, size_t) noexcept { alloc::detail::release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { alloc::detail::release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alloc::detail::release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { alloc::detail::release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { alloc::detail::release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { alloc::detail::release(p); }
+
+#define ALLOC_CONCAT_(a, b) a##b
+#define ALLOC_CONCAT(a, b) ALLOC_CONCAT_(a, b)
+#define ALLOC_REGION(name) ::alloc::Region ALLOC_CONCAT(allocRegion_, __LINE__){name}
+#define ALLOC_FORBID(name) ::alloc::Region ALLOC_CONCAT(allocRegion_, __LINE__){name, true}
+#define ALLOC_REPORT() ::alloc::report(std::cout)
+
+#else
+
+namespace alloc {
+inline void recordAllocation(size_t) {}
+inline void recordRelease(size_t) {}
+inline uint64_t violations() { return 0; }
+
+using Context = const void*;
+inline Context context() { return nullptr; }
+struct Adopt {
+  explicit Adopt(Context) {}
+};
+} // namespace alloc
+
+#define ALLOC_REGION(name)
+#define ALLOC_FORBID(name)
+#define ALLOC_REPORT()
+
+#endif
+
+#endif //_alloc_tracker_h
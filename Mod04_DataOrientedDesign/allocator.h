@@ -0,0 +1,210 @@
+#ifndef _allocator_h
+#define _allocator_h
+
+// Allocators for the large particle arrays.
+//
+// DefaultInitAllocator default-initialises instead of value-initialising:
+// vector<float, DefaultInitAllocator<float>>(n) leaves the n floats
+// uninitialised instead of writing zeros. Besides saving a pass over the
+// memory, this leaves the pages untouched until the parallel initialisation
+// writes them, so that each page is placed on the NUMA node of the thread that
+// will process it ("first touch").
+//
+// HugePageAllocator maps every array of 2 MB or more directly with mmap, on 2 MB
+// boundaries, and applies the process-wide memoryPolicy():
+//
+//   pages       None         4 KB pages
+//               Transparent  madvise(MADV_HUGEPAGE): the kernel backs the
+//                            array with 2 MB pages when it can (THP)
+//               Explicit     MAP_HUGETLB, from the pool reserved in
+//                            /proc/sys/vm/nr_hugepages; falls back to
+//                            Transparent when the pool is empty
+//   placement   FirstTouch   each page goes to the node of the thread that
+//                            writes it first (the Linux default)
+//               Interleave   the pages are spread round-robin over the NUMA
+//                            nodes (mbind MPOL_INTERLEAVE), for data that is
+//                            not accessed with the parallelFor partition
+//
+// With 2 MB pages a 400 MB array needs 200 TLB entries instead of 100'000.
+// Smaller arrays come from operator new, as with std::allocator. The mapped
+// arrays are reported to alloc_tracker.h, which sees operator new by itself.
+//
+// Arrays that all started on a 2 MB boundary would have posx[i], posy[i], ...
+// in the same cache set, and the ten streams of the SoA kernels would evict
+// each other from L1 and L2 (applyForce4 was 8 times slower). The start of each
+// mapped array is therefore shifted by a different multiple of 17 cache lines.
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "alloc_tracker.h"
+
+enum class HugePages { None, Transparent, Explicit };
+enum class Placement { FirstTouch, Interleave };
+
+struct MemoryPolicy {
+  HugePages pages = HugePages::Transparent;
+  Placement placement = Placement::FirstTouch;
+};
+
+inline MemoryPolicy& memoryPolicy() {
+  static MemoryPolicy policy;
+  return policy;
+}
+
+namespace alloc_detail {
+
+constexpr size_t hugePageSize = size_t(2) << 20;
+
+constexpr size_t staggerStep = 17 * 64;
+constexpr size_t staggerSlots = 32;
+
+// The size of the mapping holding an array of `bytes`, including room for the
+// shift of its start.
+inline size_t mappedSize(size_t bytes) {
+  bytes += staggerStep * (staggerSlots - 1);
+  return (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+}
+
+inline size_t nextStagger() {
+  static std::atomic<size_t> counter{0};
+  return counter++ % staggerSlots * staggerStep;
+}
+
+// The bitmask of the NUMA nodes with memory, from sysfs ("0", "0-1", "0,2-3").
+inline uint64_t memoryNodes() {
+  uint64_t mask = 0;
+  std::ifstream file("/sys/devices/system/node/has_memory");
+  std::string line;
+  std::getline(file, line);
+  std::stringstream ss(line);
+  for (std::string range; std::getline(ss, range, ',');) {
+    size_t dash = range.find('-');
+    unsigned first = std::stoul(range);
+    unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+    for (unsigned node = first; node <= last && node < 64; ++node) {
+      mask |= uint64_t(1) << node;
+    }
+  }
+  return mask ? mask : 1;
+}
+
+inline void interleave(void* p, size_t bytes) {
+  constexpr int MPOL_INTERLEAVE_ = 3;
+  static const uint64_t nodes = memoryNodes();
+  if (nodes & (nodes - 1)) {
+    syscall(SYS_mbind, p, bytes, MPOL_INTERLEAVE_, &nodes, 64, 0);
+  }
+}
+
+// A mapping of `bytes` (a multiple of hugePageSize) aligned on hugePageSize.
+inline void* mapHuge(size_t bytes, const MemoryPolicy& policy) {
+  void* p = MAP_FAILED;
+  if (policy.pages == HugePages::Explicit) {
+    p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+  }
+  if (p == MAP_FAILED) {
+    // Over-map by one huge page and trim both ends to get the alignment.
+    char* raw = static_cast<char*>(mmap(nullptr, bytes + hugePageSize, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    char* aligned = raw + (hugePageSize - (uintptr_t)raw % hugePageSize) % hugePageSize;
+    if (aligned != raw) munmap(raw, aligned - raw);
+    munmap(aligned + bytes, raw + hugePageSize - aligned);
+    p = aligned;
+    if (policy.pages != HugePages::None) {
+      madvise(p, bytes, MADV_HUGEPAGE);
+    }
+  }
+  if (policy.placement == Placement::Interleave) {
+    interleave(p, bytes);
+  }
+  return p;
+}
+
+} // namespace alloc_detail
+
+template<class T>
+struct HugePageAllocator {
+  using value_type = T;
+
+  HugePageAllocator() = default;
+  template<class U>
+  HugePageAllocator( const HugePageAllocator<U>& ) {}
+
+  // Whether an array of n elements is mapped is decided by its size only, so
+  // that deallocate() agrees with allocate() whatever the policy is by then.
+  static bool mapped(size_t n) { return n * sizeof(T) >= alloc_detail::hugePageSize; }
+
+  T* allocate(size_t n) {
+    if (!mapped(n)) {
+      return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{alignof(T) > 64 ? alignof(T) : 64}));
+    }
+    using namespace alloc_detail;
+    char* base = static_cast<char*>(mapHuge(mappedSize(n * sizeof(T)), memoryPolicy()));
+    alloc::recordAllocation(mappedSize(n * sizeof(T)));
+    return reinterpret_cast<T*>(base + nextStagger());
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (!mapped(n)) {
+      ::operator delete(p, std::align_val_t{alignof(T) > 64 ? alignof(T) : 64});
+      return;
+    }
+    using namespace alloc_detail;
+    // The mapping starts at the 2 MB boundary below p.
+    char* base = reinterpret_cast<char*>((uintptr_t)p / hugePageSize * hugePageSize);
+    munmap(base, mappedSize(n * sizeof(T)));
+    alloc::recordRelease(mappedSize(n * sizeof(T)));
+  }
+
+  friend bool operator==(const HugePageAllocator&, const HugePageAllocator&) { return true; }
+};
+
+template<class T, class Base = std::allocator<T>>
+struct DefaultInitAllocator: Base {
+  using value_type = T;
+
+  template<class U>
+  struct rebind {
+    using other = DefaultInitAllocator<U, typename std::allocator_traits<Base>::template rebind_alloc<U>>;
+  };
+
+  DefaultInitAllocator() = default;
+  template<class U, class B>
+  DefaultInitAllocator( const DefaultInitAllocator<U, B>& other ): Base(static_cast<const B&>(other)) {}
+
+  template<class U>
+  void construct(U* p) {
+    ::new (static_cast<void*>(p)) U;
+  }
+
+  template<class U, class... Args>
+  void construct(U* p, Args&&... args) {
+    std::allocator_traits<Base>::construct(static_cast<Base&>(*this), p, std::forward<Args>(args)...);
+  }
+};
+
+// The vector type used for particle data.
+template<class T>
+using ParticleVector = std::vector<T, DefaultInitAllocator<T, HugePageAllocator<T>>>;
+
+inline HugePages parseHugePages(const std::string& s) {
+  return s == "none" ? HugePages::None : s == "explicit" ? HugePages::Explicit : HugePages::Transparent;
+}
+
+inline Placement parsePlacement(const std::string& s) {
+  return s == "interleave" ? Placement::Interleave : Placement::FirstTouch;
+}
+
+#endif //_allocator_h
@@ -0,0 +1,89 @@
+#ifndef _arena_h
+#define _arena_h
+
+// Monotonic arena allocation with non-owning handles.
+//
+// An Arena hands out memory by bumping a pointer inside large blocks, and
+// releases everything at once when it is destroyed. Objects allocated one
+// after the other are therefore adjacent in memory, in allocation order, and
+// an allocation costs a few instructions instead of a call to malloc.
+//
+// ArenaPtr<T> is a plain pointer with the interface of a smart pointer
+// (->, *, get, bool): copying it involves no reference counting and no atomic
+// operation. It does not own the object, the arena does, and the arena must
+// outlive all its handles. Only trivially destructible types can be placed in
+// an arena, since their destructors are never called.
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class Arena {
+public:
+  // The first block holds `_blockSize` bytes. When it is full, the following
+  // blocks hold `_overflowSize` bytes (by default, as much as the first one):
+  // a caller that sizes the first block for everything it allocates can keep
+  // the cost of a small underestimate small.
+  explicit Arena( size_t _blockSize = 1 << 20, size_t _overflowSize = 0 )
+    : blockSize(_blockSize), overflowSize(_overflowSize ? _overflowSize : _blockSize) {}
+
+  Arena(Arena&&) = default;
+  Arena& operator=(Arena&&) = default;
+
+  // `alignment` must be a power of two.
+  void* allocate(size_t bytes, size_t alignment) {
+    if (!blocks.empty()) {
+      size_t base = (size_t)blocks.back().get();
+      size_t offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+      if (offset + bytes <= capacity) {
+        used = offset + bytes;
+        return blocks.back().get() + offset;
+      }
+    }
+    capacity = std::max(blocks.empty() ? blockSize : overflowSize, bytes + alignment);
+    blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(capacity));
+    total += capacity;
+    used = 0;
+    return allocate(bytes, alignment);
+  }
+
+  // Bytes reserved from the system so far.
+  size_t reserved() const { return total; }
+
+private:
+  size_t blockSize;
+  size_t overflowSize;
+  size_t capacity = 0;
+  size_t used = 0;
+  size_t total = 0;
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+};
+
+template<class T>
+class ArenaPtr {
+public:
+  ArenaPtr() = default;
+  explicit ArenaPtr( T* _ptr ): ptr(_ptr) {}
+
+  T* operator->() const { return ptr; }
+  T& operator*() const { return *ptr; }
+  T* get() const { return ptr; }
+  explicit operator bool() const { return ptr != nullptr; }
+
+private:
+  T* ptr = nullptr;
+};
+
+// The arena counterpart of make_shared.
+template<class T, class... Args>
+ArenaPtr<T> makeArena(Arena& arena, Args&&... args) {
+  static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+  void* p = arena.allocate(sizeof(T), alignof(T));
+  return ArenaPtr<T>(new (p) T(std::forward<Args>(args)...));
+}
+
+#endif //_arena_h
@@ -0,0 +1,246 @@
+#ifndef _bench_h
+#define _bench_h
+
+// A small benchmark harness.
+//
+// A benchmark case is identified by (kernel, layout, n, threads). For each case
+// the harness runs a few warm-up iterations, then measures `reps` samples; a
+// sample repeats the kernel enough times to last at least `minSampleTime`, so
+// that cache-resident sizes, which run in microseconds, are still measured
+// reliably. The median and percentiles of the samples are reported together
+// with the throughput in particles/s and in GB/s of useful data.
+//
+// The options are read from the command line:
+//   --sizes 1e3,1e5,1e7     numbers of particles
+//   --threads 1,2,4         thread counts to sweep (0 = all hardware threads)
+//   --kernels a,b           only run the kernels whose name contains a or b
+//   --layouts a,b           only run the layouts whose name contains a or b
+//   --reps 11 --warmup 2    number of measured samples and of warm-up samples
+//   --time-steps 1,8,32     steps per call of the multi-step kernels
+//   --label name            a tag for the build, stored in every record
+//   --csv file --json file  machine-readable output, suitable for comparing builds
+//   --huge-pages thp        none, thp or explicit: page size of the particle arrays
+//   --numa first-touch      first-touch or interleave: NUMA placement (see allocator.h)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "allocator.h"
+#include "parallel.h"
+
+// Prevents the compiler from optimising away a value that is otherwise unused.
+template<class T>
+inline void doNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchConfig {
+  std::vector<size_t> sizes = { 1'000, 10'000, 100'000, 1'000'000, 10'000'000 };
+  std::vector<unsigned> threads = { 1 };
+  std::vector<std::string> kernels;
+  std::vector<std::string> layouts;
+  std::vector<int> timeSteps = { 8 };
+  int reps = 11;
+  int warmup = 2;
+  double minSampleTime = 1e-3;
+  std::string label = "default";
+  std::string csv;
+  std::string json;
+
+  static BenchConfig fromArgs(int argc, char* argv[]) {
+    BenchConfig config;
+    auto split = [](const std::string& s) {
+      std::vector<std::string> items;
+      std::stringstream ss(s);
+      for (std::string item; getline(ss, item, ',');) {
+        if (!item.empty()) items.push_back(item);
+      }
+      return items;
+    };
+    for (int i = 1; i + 1 < argc; i += 2) {
+      std::string key = argv[i], value = argv[i + 1];
+      if (key == "--sizes") {
+        config.sizes.clear();
+        for (auto& s: split(value)) config.sizes.push_back((size_t)std::stod(s));
+      }
+      else if (key == "--threads") {
+        config.threads.clear();
+        for (auto& s: split(value)) {
+          unsigned t = std::stoul(s);
+          config.threads.push_back(t == 0 ? std::thread::hardware_concurrency() : t);
+        }
+      }
+      else if (key == "--kernels") config.kernels = split(value);
+      else if (key == "--layouts") config.layouts = split(value);
+      else if (key == "--time-steps") {
+        config.timeSteps.clear();
+        for (auto& s: split(value)) config.timeSteps.push_back(std::max(1, std::stoi(s)));
+      }
+      else if (key == "--reps") config.reps = std::max(1, std::stoi(value));
+      else if (key == "--warmup") config.warmup = std::stoi(value);
+      else if (key == "--min-time") config.minSampleTime = std::stod(value);
+      else if (key == "--label") config.label = value;
+      else if (key == "--csv") config.csv = value;
+      else if (key == "--json") config.json = value;
+      else if (key == "--huge-pages") memoryPolicy().pages = parseHugePages(value);
+      else if (key == "--numa") memoryPolicy().placement = parsePlacement(value);
+      else std::cerr << "Ignoring unknown option " << key << "\n";
+    }
+    return config;
+  }
+
+  static bool matches(const std::vector<std::string>& filters, const std::string& name) {
+    return filters.empty() || std::any_of(filters.begin(), filters.end(),
+                                          [&](auto& f) { return name.find(f) != std::string::npos; });
+  }
+};
+
+// Useful work done by a kernel per particle, independent of the layout:
+// bytes read plus bytes written, and floating-point operations.
+struct KernelInfo {
+  std::string name;
+  double bytesPerParticle;
+  double flopsPerParticle;
+};
+
+struct BenchResult {
+  std::string kernel;
+  std::string layout;
+  size_t n;
+  unsigned threads;
+  KernelInfo info;
+  std::vector<double> seconds;  // per kernel call, one entry per sample
+
+  double percentile(double p) const {
+    auto s = seconds;
+    std::sort(s.begin(), s.end());
+    double pos = p * (s.size() - 1);
+    size_t lo = (size_t)pos;
+    size_t hi = std::min(lo + 1, s.size() - 1);
+    return s[lo] + (pos - lo) * (s[hi] - s[lo]);
+  }
+  double median() const { return percentile(0.5); }
+  double particlesPerSecond() const { return n / median(); }
+  double gbPerSecond() const { return n * info.bytesPerParticle / median() * 1e-9; }
+  double gflops() const { return n * info.flopsPerParticle / median() * 1e-9; }
+};
+
+class Benchmark {
+public:
+  explicit Benchmark( BenchConfig _config ): config(std::move(_config)) {}
+
+  const BenchConfig& cfg() const { return config; }
+
+  bool wants(const std::string& kernel, const std::string& layout) const {
+    return BenchConfig::matches(config.kernels, kernel) && BenchConfig::matches(config.layouts, layout);
+  }
+
+  bool wantsLayout(const std::string& layout) const {
+    return BenchConfig::matches(config.layouts, layout);
+  }
+
+  // Measures `kernel` for every thread count of the configuration.
+  void run(const KernelInfo& info, const std::string& layout, size_t n, const std::function<void()>& kernel) {
+    if (!wants(info.name, layout)) {
+      return;
+    }
+    for (unsigned t: config.threads) {
+      setNumThreads(t);
+      BenchResult r{ info.name, layout, n, t, info, {} };
+
+      // Calibrate the number of calls per sample on the first warm-up call.
+      auto t0 = clock::now();
+      kernel();
+      double once = std::chrono::duration<double>(clock::now() - t0).count();
+      size_t calls = std::max<size_t>(1, (size_t)std::ceil(config.minSampleTime / std::max(once, 1e-9)));
+      for (int w = 0; w < config.warmup; ++w) {
+        sample(kernel, calls);
+      }
+      for (int rep = 0; rep < config.reps; ++rep) {
+        r.seconds.push_back(sample(kernel, calls));
+      }
+      print(r);
+      results.push_back(std::move(r));
+    }
+  }
+
+  // Writes the CSV and JSON files requested on the command line.
+  void finish() const {
+    if (!config.csv.empty()) {
+      std::ofstream ofile(config.csv);
+      ofile << "label,kernel,layout,n,threads,reps,median_s,p10_s,p90_s,min_s,max_s,"
+               "particles_per_s,gb_per_s,gflops,bytes_per_particle,flops_per_particle\n";
+      for (auto& r: results) {
+        ofile << config.label << "," << r.kernel << "," << r.layout << "," << r.n << "," << r.threads << ","
+              << r.seconds.size() << std::scientific << std::setprecision(6) << ","
+              << r.median() << "," << r.percentile(0.1) << "," << r.percentile(0.9) << ","
+              << r.percentile(0) << "," << r.percentile(1) << ","
+              << r.particlesPerSecond() << "," << r.gbPerSecond() << "," << r.gflops() << std::defaultfloat << ","
+              << r.info.bytesPerParticle << "," << r.info.flopsPerParticle << "\n";
+      }
+    }
+    if (!config.json.empty()) {
+      std::ofstream ofile(config.json);
+      ofile << "{\n  \"label\": \"" << config.label << "\",\n  \"results\": [\n";
+      for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        ofile << "    {\"kernel\": \"" << r.kernel << "\", \"layout\": \"" << r.layout << "\", \"n\": " << r.n
+              << ", \"threads\": " << r.threads << std::scientific << std::setprecision(6)
+              << ", \"median_s\": " << r.median() << ", \"p10_s\": " << r.percentile(0.1)
+              << ", \"p90_s\": " << r.percentile(0.9)
+              << ", \"particles_per_s\": " << r.particlesPerSecond() << ", \"gb_per_s\": " << r.gbPerSecond()
+              << ", \"gflops\": " << r.gflops() << std::defaultfloat
+              << ", \"bytes_per_particle\": " << r.info.bytesPerParticle
+              << ", \"flops_per_particle\": " << r.info.flopsPerParticle << ", \"samples_s\": [";
+        for (size_t s = 0; s < r.seconds.size(); ++s) {
+          ofile << (s ? ", " : "") << std::scientific << r.seconds[s] << std::defaultfloat;
+        }
+        ofile << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+      }
+      ofile << "  ]\n}\n";
+    }
+  }
+
+  const std::vector<BenchResult>& all() const { return results; }
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  static double sample(const std::function<void()>& kernel, size_t calls) {
+    auto t0 = clock::now();
+    for (size_t c = 0; c < calls; ++c) {
+      kernel();
+    }
+    return std::chrono::duration<double>(clock::now() - t0).count() / calls;
+  }
+
+  void print(const BenchResult& r) {
+    if (!headerPrinted) {
+      std::cout << std::left << std::setw(22) << "kernel" << std::setw(14) << "layout" << std::right
+                << std::setw(12) << "n" << std::setw(5) << "thr" << std::setw(13) << "median[us]"
+                << std::setw(11) << "p10[us]" << std::setw(11) << "p90[us]"
+                << std::setw(11) << "Mpart/s" << std::setw(9) << "GB/s" << "\n";
+      headerPrinted = true;
+    }
+    std::cout << std::left << std::setw(22) << r.kernel << std::setw(14) << r.layout << std::right
+              << std::setw(12) << r.n << std::setw(5) << r.threads << std::fixed << std::setprecision(2)
+              << std::setw(13) << r.median() * 1e6 << std::setw(11) << r.percentile(0.1) * 1e6
+              << std::setw(11) << r.percentile(0.9) * 1e6
+              << std::setw(11) << r.particlesPerSecond() * 1e-6 << std::setw(9) << r.gbPerSecond()
+              << std::defaultfloat << std::endl;
+  }
+
+  BenchConfig config;
+  std::vector<BenchResult> results;
+  bool headerPrinted = false;
+};
+
+#endif //_bench_h
@@ -0,0 +1,76 @@
+#ifndef _cache_info_h
+#define _cache_info_h
+
+// The data caches of this machine, as the kernel reports them in
+// /sys/devices/system/cpu/cpu0/cache, for the tools that size their arrays
+// after the cache levels (roofline.cpp, memory_latency.cpp).
+//
+// Virtual machines report whatever the hypervisor tells them, which is not
+// always the hardware underneath: the measured staircases are the reference,
+// these sizes only say where to look.
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CacheLevel {
+  std::string name;   // "L1", "L2", ...
+  size_t bytes;       // size of one instance of the cache
+  unsigned sharers;   // number of hardware threads sharing an instance
+};
+
+// The data and unified caches of cpu0, smallest first. Falls back to a
+// typical 32K L1, 1M L2 and 32M L3 when sysfs has no cache information.
+inline std::vector<CacheLevel> cacheLevels() {
+  std::vector<CacheLevel> levels;
+  for (int index = 0;; ++index) {
+    const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+    std::ifstream levelFile(dir + "level"), typeFile(dir + "type"), sizeFile(dir + "size"),
+                  sharedFile(dir + "shared_cpu_list");
+    if (!levelFile) {
+      break;
+    }
+    int level;
+    std::string type, size, shared;
+    levelFile >> level;
+    typeFile >> type;
+    sizeFile >> size;
+    sharedFile >> shared;
+    if (type == "Instruction" || size.empty()) {
+      continue;
+    }
+    size_t bytes = std::stoull(size);
+    if (size.back() == 'K') bytes <<= 10;
+    if (size.back() == 'M') bytes <<= 20;
+    // shared_cpu_list is a list of ranges such as "0-3,8-11".
+    unsigned sharers = 0;
+    std::stringstream ss(shared);
+    for (std::string range; std::getline(ss, range, ',');) {
+      auto dash = range.find('-');
+      sharers += dash == std::string::npos ? 1 : std::stoi(range.substr(dash + 1)) - std::stoi(range.substr(0, dash)) + 1;
+    }
+    std::string name = "L";
+    name += std::to_string(level);
+    levels.push_back({ name, bytes, std::max(1u, sharers) });
+  }
+  if (levels.empty()) {
+    std::cerr << "Cache sizes not found in sysfs, assuming 32K L1, 1M L2 and 32M L3" << std::endl;
+    levels = { { "L1", 32 << 10, 1 }, { "L2", 1 << 20, 1 }, { "L3", 32 << 20, std::thread::hardware_concurrency() } };
+  }
+  std::sort(levels.begin(), levels.end(), [](auto& x, auto& y) { return x.bytes < y.bytes; });
+  return levels;
+}
+
+// The name of the smallest level that holds `bytes` on one core, or "DRAM".
+inline std::string levelOf(const std::vector<CacheLevel>& levels, size_t bytes) {
+  for (auto& level: levels) {
+    if (bytes <= level.bytes) return level.name;
+  }
+  return "DRAM";
+}
+
+#endif //_cache_info_h
@@ -0,0 +1,79 @@
+// Total area and perimeter of N random shapes with the Kind enum: by a switch
+// on every Shape record ("switch") and by the batch kernels of ShapeStore
+// ("store"), in shuffled and kind-sorted order. The shapes are drawn and
+// measured by ../../shape_bench.h, as in
+// ../../code_shapes_before/before/bench.cpp, so the two tables can be compared
+// line by line.
+//
+//   ./bench [N ...]        default: 1000000 10000000
+//
+// The order changes the sequence of kinds that the switch sees, not the memory
+// access pattern. The store partitions the shapes by kind when they are added,
+// so the order does not matter to its kernels. "groupby" is the per-kind and
+// per-color report of the store (ShapeStore::groupBy), over shapes of 8 colors.
+
+#include "color.h"
+#include "shape.h"
+#include "shape_store.h"
+#include "../../perf_counters.h"
+#include "../../shape_bench.h"
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main( int argc, char** argv ) {
+  vector<size_t> sizes;
+  for( int i = 1; i < argc; i++ ) {
+    sizes.push_back(size_t(stod(argv[i])));
+  }
+  if( sizes.empty() ) {
+    sizes = { 1000000, 10000000 };
+  }
+
+  vector<Color> palette;
+  for( unsigned char c = 0; c < 8; c++ ) {
+    palette.push_back(Color {c, 0, 0});
+  }
+  auto& registry = perf::Registry::instance();
+  registry.counters.refresh();
+  if( !registry.counters.available() ) {
+    cout << "Hardware counters unavailable (" << registry.counters.unavailableReason() << ")" << endl;
+  }
+  cout << left << setw(10) << "variant" << setw(9) << "order" << right << setw(11) << "shapes"
+       << setw(11) << "ms" << setw(10) << "ns/shape" << setw(10) << "br-miss" << setw(10) << "L1D-miss"
+       << setw(10) << "LLC-miss" << setw(12) << "area/perim" << endl;
+
+  for( size_t n: sizes ) {
+    for( bool sorted: { false, true } ) {
+      vector<Shape> shapes;
+      shapes.reserve(n);
+      for( const Spec<Kind>& s: randomSpecs<Kind>(n, sorted) ) {
+        shapes.push_back(Shape(s.size, palette[shapes.size() % palette.size()], s.kind));
+      }
+      measure("switch", sorted ? "sorted" : "shuffled", n, [&shapes] {
+        double total_perimeter {};
+        double total_area {};
+        for( Shape& s: shapes ) {
+          total_perimeter += s.perimeter();
+          total_area += s.area();
+        }
+        return total_area/total_perimeter;
+      });
+
+      ShapeStore store;
+      for( const Shape& s: shapes ) {
+        store.add(s);
+      }
+      measure("store", sorted ? "sorted" : "shuffled", n, [&store] {
+        return store.totalArea()/store.totalPerimeter();
+      });
+      measure("groupby", sorted ? "sorted" : "shuffled", n, [&store] {
+        ShapeTotals t = store.groupBy().total();
+        return float(t.area/t.perimeter);
+      });
+    }
+  }
+}
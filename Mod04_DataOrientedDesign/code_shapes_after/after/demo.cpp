@@ -1,5 +1,6 @@
 #include "color.h"
 #include "shape.h"
+#include "shape_store.h"
 #include <vector>
 #include <iostream>
 
@@ -11,6 +12,7 @@ int main(void) {
   shapes.push_back( Shape(0.25, purple, Kind::Square));
   shapes.push_back( Shape( 1.5, red, Kind::Circle ));
   shapes.push_back( Shape( 0.25, purple, Kind::Circle ));
+  shapes.push_back( Shape( 1, 0.5, red ));
   float total_perimeter {};
   float total_area {};
 
@@ -21,5 +23,19 @@ int main(void) {
 
   std::cout << (total_area/total_perimeter) << std::endl;
 
+  // The same shapes in a store, with the kind-partitioned batch kernels.
+  ShapeStore store;
+  for( const Shape& s: shapes ) {
+    store.add(s);
+  }
+
+  std::cout << (store.totalArea()/store.totalPerimeter()) << std::endl;
 
+  // Area per color, in one pass over the store.
+  ShapeReport report = store.groupBy();
+  for( size_t c = 0; c < store.palette.size(); c++ ) {
+    const Color& color = store.palette[c];
+    std::cout << "color (" << int(color.red) << ", " << int(color.green) << ", " << int(color.blue) << "): "
+              << report.byColor(c).count << " shapes, area " << report.byColor(c).area << std::endl;
+  }
 }
@@ -0,0 +1,36 @@
+#ifndef _palette_h
+#define _palette_h
+
+// The distinct colors of a scene, so that shapes store a 1-byte index instead
+// of a Color. Scenes use a handful of colors: intern() finds a color by a
+// linear search, and fails once 256 distinct colors are in use.
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "color.h"
+
+class Palette {
+public:
+  static constexpr size_t capacity = 256;
+
+  // The index of color c, added to the palette if it is new.
+  uint8_t intern( Color c ) {
+    for (size_t i = 0; i < colors.size(); ++i) {
+      const Color& p = colors[i];
+      if (p.red == c.red && p.green == c.green && p.blue == c.blue) return uint8_t(i);
+    }
+    if (colors.size() == capacity) throw std::length_error("Palette: more than 256 colors");
+    colors.push_back(c);
+    return uint8_t(colors.size() - 1);
+  }
+
+  const Color& operator[]( uint8_t i ) const { return colors[i]; }
+  size_t size() const { return colors.size(); }
+
+private:
+  std::vector<Color> colors;
+};
+
+#endif //_palette_h
@@ -6,6 +6,8 @@ float Shape::area() {
       return 2*radius * 2*radius; 
     case Kind::Circle:
       return std::numbers::pi * radius*radius;
+    case Kind::Rectangle:
+      return 2*radius * 2*halfHeight;
   }
   return 0.0; 
 }
@@ -15,6 +17,8 @@ float Shape::perimeter() {
       return 4 * 2*radius; 
     case Kind::Circle:
       return std::numbers::pi * 2*radius;
+    case Kind::Rectangle:
+      return 2 * (2*radius + 2*halfHeight);
   }
   return 0.0;
 }
@@ -5,15 +5,19 @@
 #include "color.h"
 
 enum class Kind {
-  Square, Circle
+  Square, Circle, Rectangle
 };
 
+// radius is half the side of a square, the radius of a circle and half the
+// width of a rectangle; halfHeight is only used by rectangles.
 struct Shape {
   Color color;
   Kind kind;
   float radius;
+  float halfHeight;
 
-  Shape( float _radius, Color &_color, Kind _kind): color(_color), kind(_kind), radius(_radius) {}
+  Shape( float _radius, Color &_color, Kind _kind): color(_color), kind(_kind), radius(_radius), halfHeight(_radius) {}
+  Shape( float _radius, float _halfHeight, Color &_color ): color(_color), kind(Kind::Rectangle), radius(_radius), halfHeight(_halfHeight) {}
 
   float area();
   float perimeter();
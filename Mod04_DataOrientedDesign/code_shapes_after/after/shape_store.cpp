@@ -0,0 +1,142 @@
+#include "shape_store.h"
+#include "../../reduction.h"
+
+void ShapeStore::add( const Shape& s ) {
+  switch(s.kind) {
+    case Kind::Square:
+      addSquare(s.radius, s.color);
+      break;
+    case Kind::Circle:
+      addCircle(s.radius, s.color);
+      break;
+    case Kind::Rectangle:
+      addRectangle(s.radius, s.halfHeight, s.color);
+      break;
+  }
+}
+
+void ShapeStore::addSquare( float radius, Color color ) {
+  squareRadius.push_back(radius);
+  squareColor.push_back(palette.intern(color));
+}
+
+void ShapeStore::addCircle( float radius, Color color ) {
+  circleRadius.push_back(radius);
+  circleColor.push_back(palette.intern(color));
+}
+
+void ShapeStore::addRectangle( float halfWidth, float halfHeight, Color color ) {
+  rectangleHalfWidth.push_back(halfWidth);
+  rectangleHalfHeight.push_back(halfHeight);
+  rectangleColor.push_back(palette.intern(color));
+}
+
+size_t ShapeStore::size() const {
+  return squareRadius.size() + circleRadius.size() + rectangleHalfWidth.size();
+}
+
+size_t ShapeStore::count( Kind kind ) const {
+  switch(kind) {
+    case Kind::Square:
+      return squareRadius.size();
+    case Kind::Circle:
+      return circleRadius.size();
+    case Kind::Rectangle:
+      return rectangleHalfWidth.size();
+  }
+  return 0;
+}
+
+// Batch kernels: sums over one column, or the products of two.
+static float sumOf( const std::vector<float>& r ) {
+  const float* p = r.data();
+  return reproducibleSum(r.size(), [p](size_t i) { return p[i]; });
+}
+
+static float sumOfSquares( const std::vector<float>& r ) {
+  const float* p = r.data();
+  return reproducibleSum(r.size(), [p](size_t i) { return p[i]*p[i]; });
+}
+
+static float sumOfProducts( const std::vector<float>& a, const std::vector<float>& b ) {
+  const float *p = a.data(), *q = b.data();
+  return reproducibleSum(a.size(), [p, q](size_t i) { return p[i]*q[i]; });
+}
+
+float ShapeStore::totalArea() const {
+  return 4*sumOfSquares(squareRadius)
+       + std::numbers::pi_v<float>*sumOfSquares(circleRadius)
+       + 4*sumOfProducts(rectangleHalfWidth, rectangleHalfHeight);
+}
+
+float ShapeStore::totalPerimeter() const {
+  return 8*sumOf(squareRadius)
+       + 2*std::numbers::pi_v<float>*sumOf(circleRadius)
+       + 4*(sumOf(rectangleHalfWidth) + sumOf(rectangleHalfHeight));
+}
+
+ShapeTotals ShapeReport::byKind( Kind kind ) const {
+  ShapeTotals t;
+  for( size_t c = 0; c < colors; c++ ) {
+    t += of(kind, uint8_t(c));
+  }
+  return t;
+}
+
+ShapeTotals ShapeReport::byColor( uint8_t color ) const {
+  ShapeTotals t;
+  for( size_t k = 0; k < numKinds; k++ ) {
+    t += of(Kind(k), color);
+  }
+  return t;
+}
+
+ShapeTotals ShapeReport::total() const {
+  ShapeTotals t;
+  for( const ShapeTotals& g: groups ) {
+    t += g;
+  }
+  return t;
+}
+
+// Adds the shapes of one kind to the groups of their color, with per-thread
+// tables. area(i) and perimeter(i) are those of shape i of the column.
+template<class Area, class Perimeter>
+static void groupByColor( const std::vector<uint8_t>& color, size_t colors, Area area, Perimeter perimeter,
+                          ShapeTotals* groups ) {
+  const uint8_t* c = color.data();
+  auto totals = parallelReduce(color.size(), std::vector<ShapeTotals>(colors), [&](size_t first, size_t last) {
+    std::vector<ShapeTotals> part(colors);
+    for( size_t i = first; i < last; i++ ) {
+      ShapeTotals& g = part[c[i]];
+      g.count++;
+      g.area += area(i);
+      g.perimeter += perimeter(i);
+    }
+    return part;
+  }, [](std::vector<ShapeTotals> a, const std::vector<ShapeTotals>& b) {
+    for( size_t k = 0; k < a.size(); k++ ) {
+      a[k] += b[k];
+    }
+    return a;
+  });
+  std::copy(totals.begin(), totals.end(), groups);
+}
+
+ShapeReport ShapeStore::groupBy() const {
+  const size_t colors = palette.size();
+  ShapeReport report { colors, std::vector<ShapeTotals>(numKinds * colors) };
+  const float *sr = squareRadius.data(), *cr = circleRadius.data();
+  const float *hw = rectangleHalfWidth.data(), *hh = rectangleHalfHeight.data();
+  constexpr float pi = std::numbers::pi_v<float>;
+  groupByColor(squareColor, colors,
+               [sr](size_t i) { return 4*sr[i]*sr[i]; }, [sr](size_t i) { return 8*sr[i]; },
+               &report.groups[size_t(Kind::Square) * colors]);
+  groupByColor(circleColor, colors,
+               [cr](size_t i) { return pi*cr[i]*cr[i]; }, [cr](size_t i) { return 2*pi*cr[i]; },
+               &report.groups[size_t(Kind::Circle) * colors]);
+  groupByColor(rectangleColor, colors,
+               [hw, hh](size_t i) { return 4*hw[i]*hh[i]; }, [hw, hh](size_t i) { return 4*(hw[i] + hh[i]); },
+               &report.groups[size_t(Kind::Rectangle) * colors]);
+  return report;
+}
@@ -0,0 +1,80 @@
+#ifndef _shape_store_h
+#define _shape_store_h
+
+// Shapes stored by kind: one dense column of sizes per Kind, instead of a
+// vector of Shape records with a switch on the kind of each element.
+//
+// The kind of a shape is the column it is in, so the kernels know it
+// statically: totalArea() and totalPerimeter() are, per kind, a sum of r*r or
+// r over a float column times a constant, without a branch. The sums run on
+// the SIMD registers and, for large stores, on all the threads, with
+// reproducibleSum (../../reduction.h): the result is the same whatever the
+// number of threads. They read 4 bytes per shape (8 for rectangles) instead of
+// a 16-byte Shape.
+//
+// Colors are interned in a palette and each shape keeps a 1-byte index, in a
+// column of its own that the geometric kernels do not touch. groupBy() computes
+// the count, area and perimeter of every (kind, color) group in one pass over
+// the columns: each thread aggregates its chunk into a private table, and the
+// tables are added at the end.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "color.h"
+#include "palette.h"
+#include "shape.h"
+
+constexpr size_t numKinds = 3;
+
+struct ShapeTotals {
+  size_t count {};
+  double area {};
+  double perimeter {};
+
+  ShapeTotals& operator+=( const ShapeTotals& o ) {
+    count += o.count;
+    area += o.area;
+    perimeter += o.perimeter;
+    return *this;
+  }
+};
+
+// The totals of the shapes per kind and color index.
+struct ShapeReport {
+  size_t colors;
+  std::vector<ShapeTotals> groups;   // [kind * colors + color]
+
+  const ShapeTotals& of( Kind kind, uint8_t color ) const { return groups[size_t(kind) * colors + color]; }
+  ShapeTotals byKind( Kind kind ) const;
+  ShapeTotals byColor( uint8_t color ) const;
+  ShapeTotals total() const;
+};
+
+struct ShapeStore {
+  // Sizes as in Shape: radius for squares (half the side) and circles,
+  // half-width and half-height for rectangles.
+  std::vector<float> squareRadius;
+  std::vector<float> circleRadius;
+  std::vector<float> rectangleHalfWidth;
+  std::vector<float> rectangleHalfHeight;
+  // Indices into the palette.
+  std::vector<uint8_t> squareColor;
+  std::vector<uint8_t> circleColor;
+  std::vector<uint8_t> rectangleColor;
+  Palette palette;
+
+  void add( const Shape& s );
+  void addSquare( float radius, Color color );
+  void addCircle( float radius, Color color );
+  void addRectangle( float halfWidth, float halfHeight, Color color );
+
+  size_t size() const;
+  size_t count( Kind kind ) const;
+
+  float totalArea() const;
+  float totalPerimeter() const;
+  ShapeReport groupBy() const;
+};
+
+#endif //_shape_store_h
@@ -0,0 +1,68 @@
+// Total area and perimeter of N random shapes through the virtual Shape
+// interface, in shuffled and kind-sorted order. The shapes are drawn and
+// measured by ../../shape_bench.h, as in
+// ../../code_shapes_after/after/bench.cpp, so the two tables can be compared
+// line by line.
+//
+//   ./bench [N ...]        default: 1000000 10000000
+//
+// The shapes are allocated in the order in which they are visited, so the two
+// orders differ in the sequence of kinds (what the indirect branch predictor
+// sees), not in the memory access pattern.
+
+#include "color.h"
+#include "shape.h"
+#include "square.h"
+#include "circle.h"
+#include "../../perf_counters.h"
+#include "../../shape_bench.h"
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class Kind { Square, Circle };
+
+int main( int argc, char** argv ) {
+  vector<size_t> sizes;
+  for( int i = 1; i < argc; i++ ) {
+    sizes.push_back(size_t(stod(argv[i])));
+  }
+  if( sizes.empty() ) {
+    sizes = { 1000000, 10000000 };
+  }
+
+  auto red = make_shared<Color>(Color {255, 0, 0} );
+  auto& registry = perf::Registry::instance();
+  registry.counters.refresh();
+  if( !registry.counters.available() ) {
+    cout << "Hardware counters unavailable (" << registry.counters.unavailableReason() << ")" << endl;
+  }
+  cout << left << setw(10) << "variant" << setw(9) << "order" << right << setw(11) << "shapes"
+       << setw(11) << "ms" << setw(10) << "ns/shape" << setw(10) << "br-miss" << setw(10) << "L1D-miss"
+       << setw(10) << "LLC-miss" << setw(12) << "area/perim" << endl;
+
+  for( size_t n: sizes ) {
+    for( bool sorted: { false, true } ) {
+      vector<shared_ptr<Shape>> shapes;
+      shapes.reserve(n);
+      for( const Spec<Kind>& s: randomSpecs<Kind>(n, sorted) ) {
+        // Square takes the side, Shape of the after version the half side.
+        if( s.kind == Kind::Square ) shapes.push_back(make_shared<Square>(2*s.size, red));
+        else shapes.push_back(make_shared<Circle>(s.size, red));
+      }
+      measure("virtual", sorted ? "sorted" : "shuffled", n, [&shapes] {
+        double total_perimeter {};
+        double total_area {};
+        for( const shared_ptr<Shape>& s: shapes ) {
+          total_perimeter += s->perimeter();
+          total_area += s->area();
+        }
+        return total_area/total_perimeter;
+      });
+    }
+  }
+}
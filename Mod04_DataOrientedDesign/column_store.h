@@ -0,0 +1,145 @@
+#ifndef _column_store_h
+#define _column_store_h
+
+// Float columns kept in a memory-mapped file, for particle sets larger than
+// the RAM.
+//
+// The file holds `columns` arrays of n floats, one after the other, each
+// padded to a whole number of pages. Kernels do not touch the mapping at random:
+// they call stream(), which walks the columns chunk by chunk, and for each
+// chunk
+//
+//   - has Linux read ahead the next `readAhead` chunks of the columns in use
+//     (madvise MADV_WILLNEED starts the reads and returns), so that the disk
+//     works while the current chunk is computed,
+//   - runs the kernel on the chunk, which is in memory by then,
+//   - if the file is larger than half the RAM ("drop-behind"), starts the
+//     write-back of the columns the kernel has modified (sync_file_range; on
+//     Linux msync MS_ASYNC does nothing), and drops the chunk from the address
+//     space (MADV_DONTNEED), so that the resident set stays at a few chunks and
+//     the page cache can evict clean pages instead of thrashing.
+//
+// A file that fits in memory stays mapped and cached: dropping it would cost a
+// page fault per 4 KB on every pass (applyForce on 1e6 cached particles took
+// 11.3 ms with drop-behind, 5.0 ms without). setStreaming() overrides the
+// choice.
+//
+// With the default chunk of 64K particles, a chunk of all ten particle columns
+// is 2.5 MB: small enough for the caches, large enough for efficient I/O.
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class ColumnStore {
+public:
+  static constexpr size_t pageSize = 4096;
+
+  // Creates (or truncates) the file at `path`. A temporary store is unlinked
+  // right away: its disk space is released when the store is destroyed.
+  ColumnStore( const std::string& path, size_t columns, size_t _n, bool temporary = false,
+               size_t _chunk = 1 << 16, size_t _readAhead = 4 )
+    : n(_n), numColumns(columns), chunk(roundToPage(std::max<size_t>(_chunk, 1))), readAhead(_readAhead),
+      columnBytes(roundToPage(_n) * sizeof(float)) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::runtime_error("ColumnStore: cannot create " + path);
+    if (temporary) unlink(path.c_str());
+    if (ftruncate(fd, bytes()) != 0) {
+      close(fd);
+      throw std::runtime_error("ColumnStore: cannot resize " + path);
+    }
+    if (bytes() > 0) {
+      void* p = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("ColumnStore: cannot map " + path);
+      }
+      base = static_cast<char*>(p);
+    }
+    dropBehind = bytes() > size_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) / 2;
+  }
+
+  ~ColumnStore() {
+    if (base) munmap(base, bytes());
+    if (fd >= 0) close(fd);
+  }
+
+  ColumnStore(ColumnStore&& o) noexcept
+    : n(o.n), numColumns(o.numColumns), chunk(o.chunk), readAhead(o.readAhead), columnBytes(o.columnBytes),
+      dropBehind(o.dropBehind), fd(std::exchange(o.fd, -1)), base(std::exchange(o.base, nullptr)) {}
+  ColumnStore& operator=(ColumnStore&&) = delete;
+
+  size_t size() const { return n; }
+  size_t chunkSize() const { return chunk; }
+  bool streaming() const { return dropBehind; }
+  void setStreaming(bool on) { dropBehind = on; }
+
+  float* column(unsigned k) { return reinterpret_cast<float*>(base + k * columnBytes); }
+  const float* column(unsigned k) const { return reinterpret_cast<const float*>(base + k * columnBytes); }
+
+  // Calls f(first, last) for consecutive chunks [first, last) of the particles,
+  // in order. f may read the columns in `reads` and read and write those in
+  // `writes`.
+  template<class F>
+  void stream(std::initializer_list<unsigned> reads, std::initializer_list<unsigned> writes, F f) {
+    // Without a copy of the columns in a vector: a time step must not allocate.
+    auto adviseAll = [&](size_t c, int advice) {
+      advise(reads, c, advice);
+      advise(writes, c, advice);
+    };
+    const size_t chunks = (n + chunk - 1) / chunk;
+    for (size_t c = 0; c < std::min(readAhead, chunks); ++c) {
+      adviseAll(c, MADV_WILLNEED);
+    }
+    for (size_t c = 0; c < chunks; ++c) {
+      if (c + readAhead < chunks) {
+        adviseAll(c + readAhead, MADV_WILLNEED);
+      }
+      f(c * chunk, std::min(n, (c + 1) * chunk));
+      if (!dropBehind) continue;
+      for (unsigned k: writes) {
+        auto [p, len] = range(k, c);
+        sync_file_range(fd, p - base, len, SYNC_FILE_RANGE_WRITE);
+      }
+      adviseAll(c, MADV_DONTNEED);
+    }
+  }
+
+private:
+  static size_t roundToPage(size_t floats) {
+    constexpr size_t perPage = pageSize / sizeof(float);
+    return (floats + perPage - 1) / perPage * perPage;
+  }
+
+  size_t bytes() const { return numColumns * columnBytes; }
+
+  // The pages of chunk c of column k.
+  std::pair<char*, size_t> range(unsigned k, size_t c) const {
+    size_t first = c * chunk, last = std::min(roundToPage(n), (c + 1) * chunk);
+    return { base + k * columnBytes + first * sizeof(float), (last - first) * sizeof(float) };
+  }
+
+  void advise(std::initializer_list<unsigned> columns, size_t c, int advice) const {
+    for (unsigned k: columns) {
+      auto [p, len] = range(k, c);
+      madvise(p, len, advice);
+    }
+  }
+
+  size_t n;
+  size_t numColumns;
+  size_t chunk;
+  size_t readAhead;
+  size_t columnBytes;
+  bool dropBehind;
+  int fd = -1;
+  char* base = nullptr;
+};
+
+#endif //_column_store_h
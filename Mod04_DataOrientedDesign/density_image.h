@@ -0,0 +1,343 @@
+#ifndef _density_image_h
+#define _density_image_h
+
+// In-situ rendering of particle positions onto a density image.
+//
+// Instead of dumping every position to a text file and rendering it offline,
+// the particles are deposited onto a width x height grid of counters, which is
+// tone-mapped to 8-bit grey levels and written as a binary PGM or a PNG file.
+// A PGM frame costs width*height bytes on disk, independently of the number of
+// particles; the PNG is compressed, and the mostly black images of a sparse
+// simulation shrink to a few kilobytes.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <execution>
+#include <fstream>
+#include <future>
+#include <ranges>
+#include <string>
+#include <thread>
+#include <vector>
+#include "alloc_tracker.h"
+
+enum class ImageFormat {
+  PGM, PNG
+};
+
+struct DensityImage {
+  size_t width;
+  size_t height;
+  std::vector<uint32_t> counts;
+
+  DensityImage( size_t _width, size_t _height ): width(_width), height(_height), counts(_width * _height) {}
+};
+
+// Deposits the particles onto the image. `extent` is the side-length of the
+// (square) simulation domain, `getPos` returns the 2D position of a particle.
+//
+// The particles are split into one tile per hardware thread. Each tile is
+// deposited into a private image so that no atomic operation is needed, and the
+// private images are then summed pixel by pixel, also in parallel. `tiles`
+// holds the private images between calls, so that a frame clears them instead
+// of allocating them.
+void depositDensity(const auto& particles, float extent, DensityImage& image,
+                    std::vector<uint32_t>& tiles, auto getPos) {
+  const size_t numTiles = std::max(1u, std::thread::hardware_concurrency());
+  const size_t numPixels = image.width * image.height;
+  const size_t tileSize = (particles.size() + numTiles - 1) / numTiles;
+  const float scaleX = image.width / extent;
+  const float scaleY = image.height / extent;
+
+  tiles.resize(numTiles * numPixels);
+  auto tileIds = std::views::iota(size_t{}, numTiles);
+  std::for_each(std::execution::par, std::begin(tileIds), std::end(tileIds), [&](size_t t) {
+    uint32_t* tile = tiles.data() + t * numPixels;
+    std::fill_n(tile, numPixels, 0);
+    size_t first = std::min(particles.size(), t * tileSize);
+    size_t last = std::min(particles.size(), first + tileSize);
+    for (size_t i = first; i < last; ++i) {
+      const auto pos = getPos(particles[i]);
+      // Clamp to the image, positions exactly on the upper boundary are possible.
+      size_t px = std::min(image.width - 1, (size_t)std::max(0.f, pos[0] * scaleX));
+      size_t py = std::min(image.height - 1, (size_t)std::max(0.f, pos[1] * scaleY));
+      // Row 0 is the top of the image, so y is flipped.
+      ++tile[(image.height - 1 - py) * image.width + px];
+    }
+  } );
+
+  // Reduce the tiles into the output image.
+  auto pixels = std::views::iota(size_t{}, numPixels);
+  std::for_each(std::execution::par, std::begin(pixels), std::end(pixels), [&](size_t p) {
+    uint32_t sum = 0;
+    for (size_t t = 0; t < numTiles; ++t) {
+      sum += tiles[t * numPixels + p];
+    }
+    image.counts[p] = sum;
+  } );
+}
+
+// Maps the particle counts to grey levels with a logarithmic scale, so that
+// sparse regions remain visible next to dense clusters.
+inline std::vector<uint8_t> toneMap(const DensityImage& image) {
+  std::vector<uint8_t> grey(image.counts.size());
+  uint32_t maxCount = *std::max_element(begin(image.counts), end(image.counts));
+  if (maxCount == 0) {
+    return grey;
+  }
+  float norm = 255.f / std::log1p((float)maxCount);
+  std::transform(std::execution::par_unseq, begin(image.counts), end(image.counts), begin(grey),
+                 [norm](uint32_t c) { return (uint8_t)std::lround(norm * std::log1p((float)c)); });
+  return grey;
+}
+
+// Writes an 8-bit grey image as binary PGM (P5).
+inline void writePGM(const std::vector<uint8_t>& grey, size_t width, size_t height, const std::string& fname) {
+  std::ofstream ofile(fname, std::ios::binary);
+  ofile << "P5\n" << width << " " << height << "\n255\n";
+  ofile.write((const char*)grey.data(), grey.size());
+}
+
+namespace png_detail {
+
+inline uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+inline void putBE32(std::vector<uint8_t>& out, uint32_t v) {
+  out.insert(out.end(), { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v });
+}
+
+// The bits of a deflate stream, least significant bit first.
+class BitWriter {
+public:
+  explicit BitWriter( std::vector<uint8_t>& _out ): out(_out) {}
+
+  void put(uint32_t bits, int count) {
+    acc |= (uint64_t)bits << n;
+    n += count;
+    while (n >= 8) {
+      out.push_back((uint8_t)acc);
+      acc >>= 8;
+      n -= 8;
+    }
+  }
+
+  // Huffman codes are stored from their most significant bit.
+  void putCode(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; ++i) {
+      reversed |= ((code >> i) & 1) << (length - 1 - i);
+    }
+    put(reversed, length);
+  }
+
+  void flush() {
+    if (n > 0) put(0, 8 - n);
+  }
+
+private:
+  std::vector<uint8_t>& out;
+  uint64_t acc = 0;
+  int n = 0;
+};
+
+// A literal (0-255), the end of block (256) or a length code (257-285) in the
+// fixed Huffman code of deflate (RFC 1951, 3.2.6).
+inline void putLiteral(BitWriter& bits, unsigned v) {
+  if (v < 144) bits.putCode(0x30 + v, 8);
+  else if (v < 256) bits.putCode(0x190 + v - 144, 9);
+  else if (v < 280) bits.putCode(v - 256, 7);
+  else bits.putCode(0xc0 + v - 280, 8);
+}
+
+inline void putMatch(BitWriter& bits, unsigned length, unsigned distance) {
+  static constexpr uint16_t lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+  static constexpr uint8_t lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+  static constexpr uint16_t distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                               193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                               6145, 8193, 12289, 16385, 24577 };
+  static constexpr uint8_t distanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                               6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+  unsigned l = 28;
+  while (lengthBase[l] > length) --l;
+  putLiteral(bits, 257 + l);
+  bits.put(length - lengthBase[l], lengthExtra[l]);
+  unsigned d = 29;
+  while (distanceBase[d] > distance) --d;
+  bits.putCode(d, 5);
+  bits.put(distance - distanceBase[d], distanceExtra[d]);
+}
+
+// Compresses `data` into one deflate block with the fixed Huffman code. Matches
+// are found greedily with a hash of the next 3 bytes and a chain of the previous
+// positions with the same hash in the 32 KB window.
+inline void deflateFixed(const std::vector<uint8_t>& data, std::vector<uint8_t>& out) {
+  constexpr size_t window = 32768, minMatch = 3, maxMatch = 258, maxChain = 64;
+  constexpr size_t hashBits = 15;
+  std::vector<int64_t> head(size_t(1) << hashBits, -1), previous(window, -1);
+  auto hash = [&data](size_t i) {
+    return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1u << hashBits) - 1);
+  };
+  auto insert = [&](size_t i) {
+    if (i + minMatch <= data.size()) {
+      const auto h = hash(i);
+      previous[i % window] = head[h];
+      head[h] = (int64_t)i;
+    }
+  };
+
+  BitWriter bits(out);
+  bits.put(1, 1);  // last block
+  bits.put(1, 2);  // fixed Huffman codes
+  for (size_t i = 0; i < data.size();) {
+    size_t bestLength = 0, bestDistance = 0;
+    if (i + minMatch <= data.size()) {
+      const size_t limit = std::min(maxMatch, data.size() - i);
+      int64_t candidate = head[hash(i)];
+      for (size_t chain = 0; candidate >= 0 && i - candidate <= window && chain < maxChain; ++chain) {
+        size_t length = 0;
+        while (length < limit && data[candidate + length] == data[i + length]) ++length;
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = i - candidate;
+          if (length == limit) break;
+        }
+        const int64_t next = previous[candidate % window];
+        if (next >= candidate) break;  // the slot was reused by a newer position
+        candidate = next;
+      }
+    }
+    if (bestLength >= minMatch) {
+      putMatch(bits, (unsigned)bestLength, (unsigned)bestDistance);
+      for (size_t k = 0; k < bestLength; ++k) insert(i + k);
+      i += bestLength;
+    }
+    else {
+      putLiteral(bits, data[i]);
+      insert(i);
+      ++i;
+    }
+  }
+  putLiteral(bits, 256);
+  bits.flush();
+}
+
+inline void writeChunk(std::ofstream& ofile, const char* type, const std::vector<uint8_t>& payload) {
+  std::vector<uint8_t> chunk;
+  putBE32(chunk, (uint32_t)payload.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), begin(payload), end(payload));
+  putBE32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+  ofile.write((const char*)chunk.data(), chunk.size());
+}
+
+} // namespace png_detail
+
+// Writes an 8-bit grey image as PNG. To stay free of external libraries, the
+// zlib stream is a single deflate block with the fixed Huffman code and LZ77
+// matches: much weaker than zlib on photographs, but the black background of a
+// density image is a few long runs, and a 512 x 512 frame of 1600 particles
+// takes a few kilobytes instead of the 262 KB of the PGM.
+inline void writePNG(const std::vector<uint8_t>& grey, size_t width, size_t height, const std::string& fname) {
+  using namespace png_detail;
+  // Each scanline is prefixed by its filter type (0 = none).
+  std::vector<uint8_t> raw;
+  raw.reserve(height * (width + 1));
+  for (size_t y = 0; y < height; ++y) {
+    raw.push_back(0);
+    raw.insert(raw.end(), begin(grey) + y * width, begin(grey) + (y + 1) * width);
+  }
+
+  std::vector<uint8_t> zlib = { 0x78, 0x01 };
+  deflateFixed(raw, zlib);
+  uint32_t a = 1, b = 0;
+  for (uint8_t c: raw) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  putBE32(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> header;
+  putBE32(header, (uint32_t)width);
+  putBE32(header, (uint32_t)height);
+  header.insert(header.end(), { 8, 0, 0, 0, 0 });  // 8-bit greyscale, no interlace
+
+  std::ofstream ofile(fname, std::ios::binary);
+  const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  ofile.write((const char*)signature, sizeof(signature));
+  writeChunk(ofile, "IHDR", header);
+  writeChunk(ofile, "IDAT", zlib);
+  writeChunk(ofile, "IEND", {});
+}
+
+inline void writeImage(const std::vector<uint8_t>& grey, size_t width, size_t height,
+                       ImageFormat format, const std::string& basename) {
+  if (format == ImageFormat::PGM) {
+    writePGM(grey, width, height, basename + ".pgm");
+  }
+  else {
+    writePNG(grey, width, height, basename + ".png");
+  }
+}
+
+// Renders frames and optionally writes them on a background thread, so that
+// the simulation proceeds while the previous frame is being encoded and
+// written. At most one frame is in flight: rendering a new frame first waits
+// for the previous write to complete.
+class DensityRenderer {
+public:
+  DensityRenderer( size_t width, size_t height, ImageFormat format, bool async )
+    : image(width, height), format(format), async(async) {}
+
+  ~DensityRenderer() { wait(); }
+
+  void render(const auto& particles, float extent, const std::string& basename, auto getPos) {
+    wait();
+    depositDensity(particles, extent, image, tiles, getPos);
+    auto write = [grey = toneMap(image), w = image.width, h = image.height, f = format, basename]() {
+      ALLOC_REGION("writeImage (async)");
+      writeImage(grey, w, h, f, basename);
+    };
+    if (async) {
+      pending = std::async(std::launch::async, std::move(write));
+    }
+    else {
+      write();
+    }
+  }
+
+  void wait() {
+    if (pending.valid()) {
+      pending.get();
+    }
+  }
+
+private:
+  DensityImage image;
+  std::vector<uint32_t> tiles;
+  ImageFormat format;
+  bool async;
+  std::future<void> pending;
+};
+
+#endif //_density_image_h
@@ -0,0 +1,168 @@
+#ifndef _half_h
+#define _half_h
+
+// 16-bit floating-point storage types, for columns that are stored narrow and
+// computed in fp32.
+//
+//   Half       IEEE fp16: 11 significant bits, range 6e-5 .. 65504
+//   BFloat16   the 16 high bits of an fp32: 8 significant bits, fp32 range
+//
+// Both convert implicitly to float and explicitly from float, rounding to
+// nearest even. simd::vload and simd::vstore are overloaded for them and
+// convert a register's worth of values in the SIMD registers: with F16C or
+// AVX-512 for Half, with integer shifts for BFloat16. Values are not checked:
+// fp16 overflows to infinity beyond 65504, and the SIMD BFloat16 store does not
+// preserve NaN payloads.
+
+#include <bit>
+#include <cstdint>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+#include "simd.h"
+
+struct Half {
+  uint16_t bits;
+
+  Half() = default;
+  explicit Half( float x ): bits(fromFloat(x)) {}
+  operator float() const { return toFloat(bits); }
+
+  static uint16_t fromFloat(float f) {
+#if defined(__F16C__)
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = int((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+    if ((x & 0x7fffffff) > 0x7f800000) return sign | 0x7e00;  // NaN
+    if (exp >= 31) return sign | 0x7c00;                       // overflow, infinity
+    uint32_t shift = 13, h;
+    if (exp <= 0) {                                            // subnormal
+      if (exp < -10) return sign;
+      mant |= 0x800000;
+      shift = 14 - exp;
+      h = mant >> shift;
+    }
+    else {
+      h = (uint32_t(exp) << 10) | (mant >> shift);
+    }
+    // Round to nearest even; a carry into the exponent is the right result.
+    uint32_t rest = mant & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1))) ++h;
+    return uint16_t(sign | h);
+#endif
+  }
+
+  static float toFloat(uint16_t h) {
+#if defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = uint32_t(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    if (exp == 0) {
+      float value = mant * 0x1p-24f;
+      return sign ? -value : value;
+    }
+    if (exp == 31) return std::bit_cast<float>(sign | 0x7f800000 | (mant << 13));
+    return std::bit_cast<float>(sign | ((exp - 15 + 127) << 23) | (mant << 13));
+#endif
+  }
+};
+
+struct BFloat16 {
+  uint16_t bits;
+
+  BFloat16() = default;
+  explicit BFloat16( float x ): bits(fromFloat(x)) {}
+  operator float() const { return std::bit_cast<float>(uint32_t(bits) << 16); }
+
+  static uint16_t fromFloat(float f) {
+    uint32_t x = std::bit_cast<uint32_t>(f);
+    if ((x & 0x7fffffff) > 0x7f800000) return uint16_t((x >> 16) | 0x40);  // quiet NaN
+    return uint16_t((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+  }
+};
+
+static_assert(sizeof(Half) == 2 && sizeof(BFloat16) == 2);
+
+namespace simd {
+
+#if defined(__AVX512F__)
+
+// Zero-masked conversions and vector-extension shifts avoid the spurious
+// -Wmaybe-uninitialized warnings of the plain intrinsics in GCC 12 (see
+// simd.h); with a full mask they compile to the same instructions.
+constexpr __mmask16 all16 = 0xffff;
+
+inline vfloat vload(const Half* p) {
+  return _mm512_maskz_cvtph_ps(all16, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+inline void vstore(Half* p, vfloat v) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_maskz_cvtps_ph(all16, v, _MM_FROUND_TO_NEAREST_INT));
+}
+inline vfloat vload(const BFloat16* p) {
+  __m512i x = _mm512_maskz_cvtepu16_epi32(all16, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  return (vfloat)((__v16su)x << 16);
+}
+inline void vstore(BFloat16* p, vfloat v) {
+  __v16su x = (__v16su)v;
+  x = (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm512_maskz_cvtepi32_epi16(all16, (__m512i)x));
+}
+
+#elif defined(__AVX2__)
+
+#if defined(__F16C__)
+inline vfloat vload(const Half* p) {
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+inline void vstore(Half* p, vfloat v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+}
+#else
+inline vfloat vload(const Half* p) {
+  alignas(32) float f[simdWidth];
+  for (size_t k = 0; k < simdWidth; ++k) f[k] = p[k];
+  return vload(f);
+}
+inline void vstore(Half* p, vfloat v) {
+  alignas(32) float f[simdWidth];
+  vstore(f, v);
+  for (size_t k = 0; k < simdWidth; ++k) p[k] = Half(f[k]);
+}
+#endif
+inline vfloat vload(const BFloat16* p) {
+  __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(x, 16));
+}
+inline void vstore(BFloat16* p, vfloat v) {
+  __m256i x = _mm256_castps_si256(v);
+  __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+  x = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), odd)), 16);
+  __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+}
+
+#else
+
+template<class Low>
+inline vfloat vloadLow(const Low* p) {
+  vfloat r;
+  for (size_t k = 0; k < simdWidth; ++k) r.v[k] = p[k];
+  return r;
+}
+template<class Low>
+inline void vstoreLow(Low* p, vfloat v) {
+  for (size_t k = 0; k < simdWidth; ++k) p[k] = Low(v.v[k]);
+}
+inline vfloat vload(const Half* p) { return vloadLow(p); }
+inline void vstore(Half* p, vfloat v) { vstoreLow(p, v); }
+inline vfloat vload(const BFloat16* p) { return vloadLow(p); }
+inline void vstore(BFloat16* p, vfloat v) { vstoreLow(p, v); }
+
+#endif
+
+} // namespace simd
+
+#endif //_half_h
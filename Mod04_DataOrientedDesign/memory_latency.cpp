@@ -0,0 +1,342 @@
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include "allocator.h"
+#include "bench.h"
+#include "cache_info.h"
+
+using namespace std;
+
+// Memory latency microbenchmarks, for 07_CacheLatencyInPractice.md and
+// 08_DataPrefetching.md measured on this machine.
+//
+// Every test but the last is a pointer chase: each cache line of the working
+// set holds the address of the next one to visit, so every load depends on the
+// previous one and the time per load is the latency of the level that holds
+// the line. The order of the lines decides what the hardware prefetchers and
+// the TLB can do:
+//
+//  chase     lines visited in a random cyclic order (Sattolo's shuffle), for
+//            working sets from 4 KB to --max-mb, on 4 KB and on 2 MB pages.
+//            The random order defeats the prefetchers, so this is the latency
+//            staircase L1 / L2 / L3 / DRAM. On 4 KB pages the large sets add
+//            the TLB misses (a page walk per load).
+//  stride    a working set of --max-mb / 4 visited with a constant stride from
+//            16 bytes to 8 KB, in address order and in random order. In
+//            address order the prefetchers see the stride and fetch ahead,
+//            until the stride crosses pages (they stop at 4 KB boundaries).
+//            Only bytes / stride lines are touched: at the largest strides
+//            they fit in L2 or L3, and both orders get faster again.
+//  tlb       one line in each of P pages, in random order, for P from 16 to
+//            --max-mb / 4 KB, on 4 KB and on 2 MB pages. The line is at a
+//            random offset in its page so that the lines do not all map to the
+//            same cache sets. The latency steps up when P exceeds the entries of
+//            the first-level and second-level TLBs on 4 KB pages, and much later
+//            on 2 MB pages.
+//  prefetch  sum of a[idx[i]] for random idx over --max-mb / 2 of floats,
+//            with __builtin_prefetch(&a[idx[i + d]]) for prefetch distances d
+//            (0 = no prefetch). The loads are independent, so the core already
+//            overlaps several misses; the prefetches keep more of them in
+//            flight and start them earlier.
+//
+// Pages are allocated with allocator.h: 4 KB pages with madvise(MADV_NOHUGEPAGE),
+// 2 MB pages with the transparent huge pages of memoryPolicy(). The report says
+// how much of the buffer the kernel actually backed with huge pages.
+//
+// Usage: memory_latency [--tests chase,stride,tlb,prefetch] [--max-mb 1024]
+//                       [--min-time 0.05] [--csv file]
+//
+// Example: g++ -std=c++20 -O3 -march=native -pthread -o memory_latency memory_latency.cpp
+
+using Clock = chrono::steady_clock;
+
+constexpr size_t lineSize = 64;
+constexpr size_t pageSize = 4096;
+
+// One row of the CSV output.
+struct Record {
+    string test;
+    string variant;
+    size_t bytes;
+    size_t parameter;   // stride, number of pages or prefetch distance
+    double nsPerAccess;
+};
+
+//// BUFFERS ////
+
+/* An anonymous mapping on 4 KB or on 2 MB pages, touched once so that the
+ * page faults are not measured.
+ */
+class Buffer {
+public:
+    Buffer( size_t _bytes, bool hugePages )
+        : bytes((_bytes + alloc_detail::hugePageSize - 1) / alloc_detail::hugePageSize * alloc_detail::hugePageSize) {
+        MemoryPolicy policy;
+        policy.pages = hugePages ? HugePages::Transparent : HugePages::None;
+        data = static_cast<char*>(alloc_detail::mapHuge(bytes, policy));
+        if( !hugePages ) {
+            madvise(data, bytes, MADV_NOHUGEPAGE);
+        }
+        for( size_t i = 0; i < bytes; i += pageSize ) {
+            data[i] = 0;
+        }
+    }
+    ~Buffer() { munmap(data, bytes); }
+    Buffer( const Buffer& ) = delete;
+    Buffer& operator=( const Buffer& ) = delete;
+
+    /* Megabytes of the buffer backed by huge pages, from /proc/self/smaps. */
+    size_t hugeMegabytes() const {
+        ifstream smaps("/proc/self/smaps");
+        bool inside = false;
+        for( string line; getline(smaps, line); ) {
+            uintptr_t first, last;
+            char dash;
+            if( isxdigit(line[0]) && (stringstream(line) >> hex >> first >> dash >> last) ) {
+                inside = first <= (uintptr_t)data && (uintptr_t)data < last;
+            }
+            else if( inside && line.rfind("AnonHugePages:", 0) == 0 ) {
+                return stoull(line.substr(14)) >> 10;
+            }
+        }
+        return 0;
+    }
+
+    char* data;
+    size_t bytes;
+};
+
+//// POINTER CHASE ////
+
+/* Links the nodes at data + offsets[order[k]] into one cycle in the order of
+ * `order` and returns the first node.
+ */
+char* link( char* data, const vector<size_t>& offsets, const vector<uint32_t>& order ) {
+    for( size_t k = 0; k < order.size(); k++ ) {
+        char* next = data + offsets[order[(k + 1) % order.size()]];
+        *reinterpret_cast<char**>(data + offsets[order[k]]) = next;
+    }
+    return data + offsets[order[0]];
+}
+
+/* A random cyclic order of n nodes: Sattolo's variant of the Fisher-Yates
+ * shuffle produces a single cycle, so the chase visits every node.
+ */
+vector<uint32_t> randomCycle( size_t n, mt19937_64& gen ) {
+    vector<uint32_t> order(n);
+    iota(order.begin(), order.end(), 0);
+    for( size_t i = n - 1; i > 0; i-- ) {
+        swap(order[i], order[uniform_int_distribution<size_t>(0, i - 1)(gen)]);
+    }
+    return order;
+}
+
+vector<uint32_t> sequentialCycle( size_t n ) {
+    vector<uint32_t> order(n);
+    iota(order.begin(), order.end(), 0);
+    return order;
+}
+
+/* Nanoseconds per load of a chase starting at p. A warm-up pass visits up to
+ * 2^20 nodes, then the number of loads is doubled until they last minTime.
+ */
+double chase( char* p, size_t nodes, double minTime ) {
+    auto run = [&]( size_t loads ) {
+        auto t0 = Clock::now();
+        for( size_t i = 0; i < loads; i += 8 ) {
+            p = *reinterpret_cast<char**>(p); p = *reinterpret_cast<char**>(p);
+            p = *reinterpret_cast<char**>(p); p = *reinterpret_cast<char**>(p);
+            p = *reinterpret_cast<char**>(p); p = *reinterpret_cast<char**>(p);
+            p = *reinterpret_cast<char**>(p); p = *reinterpret_cast<char**>(p);
+        }
+        doNotOptimize(p);
+        return chrono::duration<double>(Clock::now() - t0).count();
+    };
+    run(min<size_t>(nodes, 1 << 20));
+    size_t loads = 1 << 14;
+    double seconds = run(loads);
+    while( seconds < minTime ) {
+        loads *= 2;
+        seconds = run(loads);
+    }
+    return seconds / loads * 1e9;
+}
+
+//// TESTS ////
+
+/* The working sets of the chase: 4 KB, 6 KB, 8 KB, 12 KB, ... up to maxBytes. */
+vector<size_t> workingSets( size_t maxBytes ) {
+    vector<size_t> sizes;
+    for( size_t s = 4096; s <= maxBytes; s *= 2 ) {
+        sizes.push_back(s);
+        if( s + s / 2 <= maxBytes ) {
+            sizes.push_back(s + s / 2);
+        }
+    }
+    return sizes;
+}
+
+void testChase( size_t maxBytes, double minTime, const vector<CacheLevel>& levels, vector<Record>& records ) {
+    mt19937_64 gen(42);
+    Buffer small(maxBytes, false), huge(maxBytes, true);
+    cout << "\nchase: random cyclic order of the lines of the working set [ns per load]\n"
+         << "2 MB pages: " << huge.hugeMegabytes() << " of " << (huge.bytes >> 20) << " MB backed by huge pages\n"
+         << right << setw(14) << "bytes" << setw(7) << "level" << setw(10) << "4K pages" << setw(10) << "2M pages" << endl;
+    for( size_t bytes: workingSets(maxBytes) ) {
+        const size_t nodes = bytes / lineSize;
+        vector<size_t> offsets(nodes);
+        for( size_t k = 0; k < nodes; k++ ) offsets[k] = k * lineSize;
+        const auto order = randomCycle(nodes, gen);
+        double ns[2];
+        for( int h = 0; h < 2; h++ ) {
+            Buffer& buffer = h ? huge : small;
+            ns[h] = chase(link(buffer.data, offsets, order), nodes, minTime);
+            records.push_back({ "chase", h ? "2M" : "4K", bytes, lineSize, ns[h] });
+        }
+        cout << setw(14) << bytes << setw(7) << levelOf(levels, bytes) << fixed << setprecision(2)
+             << setw(10) << ns[0] << setw(10) << ns[1] << defaultfloat << endl;
+    }
+}
+
+void testStride( size_t maxBytes, double minTime, vector<Record>& records ) {
+    mt19937_64 gen(42);
+    const size_t bytes = maxBytes / 4;
+    Buffer buffer(bytes, true);
+    cout << "\nstride: " << (bytes >> 20) << " MB visited with a constant stride [ns per load]\n"
+         << right << setw(10) << "stride" << setw(12) << "sequential" << setw(10) << "random" << endl;
+    for( size_t stride = 16; stride <= 8192; stride *= 2 ) {
+        const size_t nodes = bytes / stride;
+        vector<size_t> offsets(nodes);
+        for( size_t k = 0; k < nodes; k++ ) offsets[k] = k * stride;
+        const double sequential = chase(link(buffer.data, offsets, sequentialCycle(nodes)), nodes, minTime);
+        const double random = chase(link(buffer.data, offsets, randomCycle(nodes, gen)), nodes, minTime);
+        records.push_back({ "stride", "sequential", bytes, stride, sequential });
+        records.push_back({ "stride", "random", bytes, stride, random });
+        cout << setw(10) << stride << fixed << setprecision(2) << setw(12) << sequential << setw(10) << random
+             << defaultfloat << endl;
+    }
+}
+
+void testTlb( size_t maxBytes, double minTime, vector<Record>& records ) {
+    mt19937_64 gen(42);
+    Buffer small(maxBytes, false), huge(maxBytes, true);
+    cout << "\ntlb: one line per 4 KB page, random order [ns per load]\n"
+         << right << setw(10) << "pages" << setw(14) << "span" << setw(10) << "4K pages" << setw(10) << "2M pages" << endl;
+    for( size_t pages = 16; pages * pageSize <= maxBytes; pages *= 2 ) {
+        vector<size_t> offsets(pages);
+        for( size_t k = 0; k < pages; k++ ) {
+            offsets[k] = k * pageSize + uniform_int_distribution<size_t>(0, pageSize / lineSize - 1)(gen) * lineSize;
+        }
+        const auto order = randomCycle(pages, gen);
+        double ns[2];
+        for( int h = 0; h < 2; h++ ) {
+            Buffer& buffer = h ? huge : small;
+            ns[h] = chase(link(buffer.data, offsets, order), pages, minTime);
+            records.push_back({ "tlb", h ? "2M" : "4K", pages * pageSize, pages, ns[h] });
+        }
+        cout << setw(10) << pages << setw(14) << pages * pageSize << fixed << setprecision(2)
+             << setw(10) << ns[0] << setw(10) << ns[1] << defaultfloat << endl;
+    }
+}
+
+/* Nanoseconds per element of sum(a[idx[i]]), prefetching `distance` elements
+ * ahead (no prefetch for 0).
+ */
+double gather( const float* a, const vector<uint32_t>& idx, size_t distance, double minTime ) {
+    const size_t n = idx.size();
+    auto run = [&] {
+        auto t0 = Clock::now();
+        float sum = 0;
+        if( distance == 0 ) {
+            for( size_t i = 0; i < n; i++ ) sum += a[idx[i]];
+        }
+        else {
+            size_t i = 0;
+            for( ; i + distance < n; i++ ) {
+                __builtin_prefetch(a + idx[i + distance]);
+                sum += a[idx[i]];
+            }
+            for( ; i < n; i++ ) sum += a[idx[i]];
+        }
+        doNotOptimize(sum);
+        return chrono::duration<double>(Clock::now() - t0).count();
+    };
+    run();
+    double best = run(), total = best;
+    for( int rep = 0; total < minTime || rep < 2; rep++ ) {
+        double s = run();
+        best = min(best, s);
+        total += s;
+    }
+    return best / n * 1e9;
+}
+
+void testPrefetch( size_t maxBytes, double minTime, vector<Record>& records ) {
+    mt19937_64 gen(42);
+    const size_t bytes = maxBytes / 2;
+    Buffer buffer(bytes, true);
+    float* a = reinterpret_cast<float*>(buffer.data);
+    const size_t n = bytes / sizeof(float);
+    fill(a, a + n, 1.f);
+    vector<uint32_t> idx(1 << 22);
+    uniform_int_distribution<uint32_t> dis(0, uint32_t(min<size_t>(n, UINT32_MAX) - 1));
+    for( auto& i: idx ) i = dis(gen);
+    cout << "\nprefetch: sum of a[idx[i]] over " << (bytes >> 20) << " MB, random idx [ns per element]\n"
+         << right << setw(10) << "distance" << setw(10) << "ns" << endl;
+    for( size_t distance: { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256 } ) {
+        const double ns = gather(a, idx, distance, minTime);
+        records.push_back({ "prefetch", distance ? "prefetch" : "none", bytes, distance, ns });
+        cout << setw(10) << distance << fixed << setprecision(2) << setw(10) << ns << defaultfloat << endl;
+    }
+}
+
+int main( int argc, char* argv[] ) {
+    vector<string> tests = { "chase", "stride", "tlb", "prefetch" };
+    size_t maxBytes = size_t(1024) << 20;
+    double minTime = 0.05;
+    string csv;
+    for( int i = 1; i + 1 < argc; i += 2 ) {
+        string key = argv[i], value = argv[i + 1];
+        if( key == "--tests" ) {
+            tests.clear();
+            stringstream ss(value);
+            for( string t; getline(ss, t, ','); ) tests.push_back(t);
+        }
+        else if( key == "--max-mb" ) maxBytes = size_t(stod(value) * (1 << 20));
+        else if( key == "--min-time" ) minTime = stod(value);
+        else if( key == "--csv" ) csv = value;
+        else cerr << "Ignoring unknown option " << key << endl;
+    }
+    maxBytes = max<size_t>(maxBytes, 1 << 20);
+
+    const auto levels = cacheLevels();
+    cout << "caches:";
+    for( auto& level: levels ) cout << " " << level.name << " " << (level.bytes >> 10) << " KB";
+    cout << endl;
+
+    vector<Record> records;
+    auto wants = [&]( const string& test ) { return find(tests.begin(), tests.end(), test) != tests.end(); };
+    if( wants("chase") ) testChase(maxBytes, minTime, levels, records);
+    if( wants("stride") ) testStride(maxBytes, minTime, records);
+    if( wants("tlb") ) testTlb(maxBytes, minTime, records);
+    if( wants("prefetch") ) testPrefetch(maxBytes, minTime, records);
+
+    if( !csv.empty() ) {
+        ofstream ofile(csv);
+        ofile << "test,variant,bytes,parameter,ns_per_access\n";
+        for( auto& r: records ) {
+            ofile << r.test << "," << r.variant << "," << r.bytes << "," << r.parameter << "," << r.nsPerAccess << "\n";
+        }
+    }
+}
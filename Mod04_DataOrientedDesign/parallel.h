@@ -0,0 +1,168 @@
+#ifndef _parallel_h
+#define _parallel_h
+
+// Static-partition parallel loops over [0, n).
+//
+// The range is cut into numThreads() contiguous chunks of (almost) equal size,
+// and chunk t is always processed by worker t. Unlike the standard parallel
+// algorithms, the number of threads can be changed at run time (for thread
+// sweeps in benchmarks), and the mapping of elements to threads is known in
+// advance, which allows a loop to touch exactly the memory that a previous
+// loop with the same partition has touched.
+//
+// The workers are kept alive in a pool between calls: a parallel loop costs a
+// wake-up, not a thread creation. Each task runs in the allocation region of
+// the thread that started it (see alloc_tracker.h).
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "alloc_tracker.h"
+#include "perf_counters.h"
+
+class ThreadPool {
+public:
+  explicit ThreadPool( unsigned _size ): size(std::max(1u, _size)) {
+    for (unsigned t = 1; t < size; ++t) {
+      workers.emplace_back([this, t] { work(t); });
+    }
+    // The regions count the workers from now on (see perf_counters.h).
+    PERF_ATTACH_THREADS();
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& w: workers) {
+      w.join();
+    }
+  }
+
+  unsigned threads() const { return size; }
+
+  // Calls task(t) for t in [0, threads()); the calling thread runs task(0).
+  void run(const std::function<void(unsigned)>& task) {
+    if (size == 1) {
+      task(0);
+      return;
+    }
+    {
+      std::lock_guard lock(mutex);
+      current = &task;
+      region = alloc::context();
+      pending = size - 1;
+      ++generation;
+    }
+    wake.notify_all();
+    task(0);
+    std::unique_lock lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+private:
+  void work(unsigned t) {
+    size_t seen = 0;
+    while (true) {
+      const std::function<void(unsigned)>* task;
+      alloc::Context caller;
+      {
+        std::unique_lock lock(mutex);
+        wake.wait(lock, [&] { return stop || generation != seen; });
+        if (stop) return;
+        seen = generation;
+        task = current;
+        caller = region;
+      }
+      {
+        alloc::Adopt adopt(caller);
+        (*task)(t);
+      }
+      {
+        std::lock_guard lock(mutex);
+        --pending;
+      }
+      done.notify_one();
+    }
+  }
+
+  unsigned size;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(unsigned)>* current = nullptr;
+  alloc::Context region = nullptr;
+  unsigned pending = 0;
+  size_t generation = 0;
+  bool stop = false;
+};
+
+inline std::unique_ptr<ThreadPool>& globalPool() {
+  static auto pool = std::make_unique<ThreadPool>(std::thread::hardware_concurrency());
+  return pool;
+}
+
+inline unsigned numThreads() {
+  return globalPool()->threads();
+}
+
+inline void setNumThreads(unsigned n) {
+  if (n != numThreads()) {
+    globalPool() = std::make_unique<ThreadPool>(n);
+  }
+}
+
+// The chunk [first, last) of [0, n) processed by worker t out of `threads`.
+inline std::pair<size_t, size_t> chunkOf(size_t n, unsigned t, unsigned threads) {
+  size_t base = n / threads, extra = n % threads;
+  size_t first = t * base + std::min<size_t>(t, extra);
+  return { first, first + base + (t < extra ? 1 : 0) };
+}
+
+// Calls f(first, last) on each chunk of [0, n), or f(first, last, t) if f
+// also wants to know the index t of the chunk. The task is passed to the pool
+// by reference: a std::function holding the lambda itself would allocate on
+// every call, and a time step must not allocate.
+template<class F>
+void parallelFor(size_t n, F f) {
+  const unsigned threads = numThreads();
+  auto task = [&](unsigned t) {
+    auto [first, last] = chunkOf(n, t, threads);
+    if (first < last) {
+      if constexpr (std::is_invocable_v<F, size_t, size_t, unsigned>) {
+        f(first, last, t);
+      }
+      else {
+        f(first, last);
+      }
+    }
+  };
+  globalPool()->run(std::ref(task));
+}
+
+// Computes partial = f(first, last) on each chunk of [0, n) and combines the
+// partial results in chunk order, starting from `init`.
+template<class T>
+T parallelReduce(size_t n, T init, auto f, auto combine) {
+  const unsigned threads = numThreads();
+  std::vector<T> partial(threads, init);
+  globalPool()->run([&](unsigned t) {
+    auto [first, last] = chunkOf(n, t, threads);
+    if (first < last) partial[t] = f(first, last);
+  });
+  for (const T& p: partial) {
+    init = combine(init, p);
+  }
+  return init;
+}
+
+#endif //_parallel_h
@@ -10,12 +10,23 @@
 #include <fstream>
 #include <iomanip>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <limits>
+#include "density_image.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "alloc_tracker.h"
 
 using namespace std;
 
 constexpr size_t N = 40;                 // The grid is of size N x N
 constexpr size_t numParticles = N * N;   // Total number of particles
 constexpr auto imageFreq = 200;          // 0 means no images
+constexpr auto imageResolution = 512;    // Side-length of the density images, in pixels
+constexpr auto imageFormat = ImageFormat::PNG;
+constexpr auto asyncImages = true;       // Write the images on a background thread
+constexpr auto textPositions = false;    // Also dump the raw positions as text (large!)
 constexpr auto policy = execution::par;
 
 // Numberical parameters in grid units (a grid cell has size 1x1,
@@ -26,6 +37,17 @@ constexpr auto maxVel = 1.f;             // Cutoff value for velocity components
 constexpr auto maxT = 150'000;           // Total number of time iterations
 constexpr auto gravityFactor = -1.e-5f;  // The G * m1 * m2 force prefactor
 
+// Work of the kernels, for the roofline (see roofline.cpp). computeAcceleration
+// and the velocity update cost 17 flops per pair of particles, counting sqrt and
+// the division as one flop; updatePositions costs 2 FMAs per particle.
+// applyAcceleration reads a Particle and writes its velocity, updatePositions
+// reads the position and the velocity and writes the position. The positions of
+// the neighbours are not counted, they are in the cache.
+constexpr auto flopsPerPair = 17.;
+constexpr auto accelerationBytes = 24. + 8.;
+constexpr auto positionFlops = 4.;
+constexpr auto positionBytes = 16. + 8.;
+
 using vec2 = array<float, 2>;
 
 
@@ -131,9 +153,45 @@ constexpr vec2 makePeriodic(vec2 pos, int posX, int posY) {
     return pos;
 }
 
+// Call f(nb) for the grid index of each of the 9 cells around a position.
+void forNeighbourCells(const vec2& position, auto f) {
+    auto iX = (int)position[0];
+    auto iY = (int)position[1];
+    for (int nbX = -1; nbX <= 1; ++nbX) {
+        for (int nbY = -1; nbY <= 1; ++nbY) {
+            f((size_t)((iY + nbY + N) % N) + N * (size_t)((iX + nbX + N) % N));
+        }
+    }
+}
+
+// Prefetch the grid entries of the 9 cells around a position.
+void prefetchNeighbourGrid(const auto& grid, const vec2& position) {
+    forNeighbourCells(position, [&grid](size_t nb) { __builtin_prefetch(&grid[nb]); });
+}
+
+// Prefetch the first particle of each of the 9 cells around a position. The
+// addresses come from the grid entries, which should already be in the cache.
+void prefetchNeighbourParticles(const auto& particles, const auto& grid, const vec2& position) {
+    forNeighbourCells(position, [&particles, &grid](size_t nb) {
+        __builtin_prefetch(&particles[min(grid[nb], particles.size() - 1)]);
+    });
+}
+
 // Compute the force between particles and update the particle velocities accordingly.
-void applyAcceleration(auto& particles, const auto& grid) {
-    for_each(policy, begin(particles), end(particles), [&particles, &grid](auto& particle) {
+// With a prefetchDistance D > 0, the neighbour cells are prefetched in two
+// stages, as in applyForce1Prefetched (SOA.cpp): while particle i is computed,
+// the grid entries of the cells around particle i + 2D, and the particles those
+// of particle i + D point to, prefetched D particles earlier (see
+// tunePrefetchDistance).
+void applyAcceleration(auto& particles, const auto& grid, size_t prefetchDistance = 0) {
+    for_each(policy, begin(particles), end(particles), [&particles, &grid, prefetchDistance](auto& particle) {
+        auto i = (size_t)(&particle - particles.data());
+        if (prefetchDistance > 0 && i + 2 * prefetchDistance < particles.size()) {
+            prefetchNeighbourGrid(grid, particles[i + 2 * prefetchDistance].position);
+        }
+        if (prefetchDistance > 0 && i + prefetchDistance < particles.size()) {
+            prefetchNeighbourParticles(particles, grid, particles[i + prefetchDistance].position);
+        }
         // Compute the grid position of the current particle.
         auto iX = (int)particle.position[0];
         auto iY = (int)particle.position[1];
@@ -166,8 +224,79 @@ void applyAcceleration(auto& particles, const auto& grid) {
     } );
 }
 
+// The prefetch distance that makes applyAcceleration fastest, from a short
+// calibration run on a copy of the particles (applyAcceleration changes the
+// velocities): the best of 5 calls for each candidate distance. A distance of 0
+// disables prefetching.
+size_t tunePrefetchDistance(const vector<Particle>& particles, const vector<size_t>& grid) {
+    constexpr array<size_t, 7> candidates = { 0, 1, 2, 4, 8, 16, 32 };
+    auto best = candidates[0];
+    auto bestTime = numeric_limits<double>::infinity();
+    for (auto distance: candidates) {
+        auto copy = particles;
+        for (int rep = 0; rep < 5; ++rep) {
+            auto start = chrono::steady_clock::now();
+            applyAcceleration(copy, grid, distance);
+            auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (seconds < bestTime) {
+                bestTime = seconds;
+                best = distance;
+            }
+        }
+    }
+    return best;
+}
+
+// Number of pairs (particle, neighbour) visited by applyAcceleration: for each
+// cell, its particles times the particles of the 3x3 cells around it, the
+// particle itself included.
+size_t countPairs(const auto& grid, size_t numParticles) {
+    auto cellSize = [&](size_t c) { return (c == grid.size() - 1 ? numParticles : grid[c + 1]) - grid[c]; };
+    size_t pairs = 0;
+    for (size_t iX = 0; iX < N; ++iX) {
+        for (size_t iY = 0; iY < N; ++iY) {
+            size_t neighbours = 0;
+            for (size_t nbX = iX + N - 1; nbX <= iX + N + 1; ++nbX) {
+                for (size_t nbY = iY + N - 1; nbY <= iY + N + 1; ++nbY) {
+                    neighbours += cellSize(nbY % N + N * (nbX % N));
+                }
+            }
+            pairs += cellSize(iY + N * iX) * neighbours;
+        }
+    }
+    return pairs;
+}
+
+// Time and work of a kernel over the whole run. --csv writes them with the
+// columns of bench.h that roofline.cpp reads.
+struct KernelTotals {
+    string name;
+    double bytesPerParticle;
+    double seconds = 0.;
+    double flops = 0.;
+    size_t calls = 0;
+
+    void add(chrono::steady_clock::time_point start, double callFlops) {
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        flops += callFlops;
+        ++calls;
+    }
+};
+
+void writeKernelTotals(const vector<KernelTotals>& kernels, string fname) {
+    ofstream ofile(fname.c_str());
+    ofile << "label,kernel,layout,n,threads,seconds_per_call,gb_per_s,gflops,bytes_per_particle,flops_per_particle\n";
+    for (auto& k: kernels) {
+        auto particles = (double)k.calls * numParticles;
+        ofile << "particle," << k.name << ",AoS-grid," << numParticles << "," << thread::hardware_concurrency() << ","
+              << k.seconds / k.calls << "," << particles * k.bytesPerParticle / k.seconds * 1e-9 << ","
+              << k.flops / k.seconds * 1e-9 << "," << k.bytesPerParticle << "," << k.flops / particles << "\n";
+    }
+}
+
 // Generate the initial particles at random positions with zero velocity.
 vector<Particle> generateParticles(size_t numParticles) {
+    ALLOC_REGION("generateParticles");
     auto generator = mt19937{random_device{}()};
     auto dis = uniform_real_distribution<float>{0.f, float{N}};
     auto particles = vector<Particle>(numParticles);
@@ -191,23 +320,74 @@ void writeParticlePositions(const vector<Particle>& particles, string fname) {
     }
 }
 
-int main() {
+// Usage: particle [--csv file], where file receives the time and the work of
+// applyAcceleration and updatePositions.
+int main(int argc, char* argv[]) {
+    auto csvFile = argc == 3 && string(argv[1]) == "--csv" ? string(argv[2]) : string();
+    auto acceleration = KernelTotals{ "applyAcceleration", accelerationBytes };
+    auto positions = KernelTotals{ "updatePositions", positionBytes };
     auto grid = vector<size_t>(N * N);
     auto particles = generateParticles(numParticles);
+    computeGrid(particles, grid);
+    // The parallel algorithms have started their threads: open their counters
+    // before the first region.
+    PERF_ATTACH_THREADS();
+    auto prefetchDistance = tunePrefetchDistance(particles, grid);
+    cout << "Prefetch distance: " << prefetchDistance << endl;
 
     auto start_time = chrono::steady_clock::now();
+    auto renderer = DensityRenderer(imageResolution, imageResolution, imageFormat, asyncImages);
     int im = 0;
     for (int t = 0; t < maxT; ++t) {
-        computeGrid(particles, grid);
-        applyAcceleration(particles, grid);
-        updatePositions(particles);
+        {
+            TRACE_SCOPE("computeGrid");
+            PERF_REGION("computeGrid");
+            ALLOC_FORBID("computeGrid");
+            computeGrid(particles, grid);
+        }
+        {
+            // Counted outside the scopes below, which measure the kernel alone.
+            auto pairs = csvFile.empty() ? size_t{0} : countPairs(grid, numParticles);
+            TRACE_SCOPE("applyAcceleration");
+            PERF_REGION("applyAcceleration");
+            ALLOC_FORBID("applyAcceleration");
+            auto start = chrono::steady_clock::now();
+            applyAcceleration(particles, grid, prefetchDistance);
+            acceleration.add(start, flopsPerPair * pairs);
+        }
+        {
+            TRACE_SCOPE("updatePositions");
+            PERF_REGION("updatePositions");
+            ALLOC_FORBID("updatePositions");
+            auto start = chrono::steady_clock::now();
+            updatePositions(particles);
+            positions.add(start, positionFlops * numParticles);
+        }
         if (imageFreq > 0 && t % imageFreq == 0) {
-            writeParticlePositions(particles, "pos_" + to_string(im++) + ".txt");
+            TRACE_SCOPE("writeImage");
+            PERF_REGION("writeImage");
+            ALLOC_REGION("writeImage");
+            renderer.render(particles, float{N}, "density_" + to_string(im),
+                            [](const Particle& p) { return p.position; });
+            if (textPositions) {
+                writeParticlePositions(particles, "pos_" + to_string(im) + ".txt");
+            }
+            ++im;
         }
     }
+    renderer.wait();
     auto end_time = chrono::steady_clock::now();
     auto interval = chrono::duration_cast<chrono::microseconds>(end_time - start_time).count();
     auto megaParticlePerSecond = (double)maxT * (double)numParticles / interval;
     cout << "Elapsed: " << interval * 1e-6 << "s" << endl;
     cout << "Efficiency: " << megaParticlePerSecond << " Mega-Particles-per-second" << endl;
+    if (!csvFile.empty()) {
+        writeKernelTotals({ acceleration, positions }, csvFile);
+    }
+    TRACE_REPORT("particle_trace.json");
+    PERF_REPORT();
+    if (alloc::violations() > 0) {
+        cerr << alloc::violations() << " allocations in time steps (see alloc_tracker.h)" << endl;
+        return 1;
+    }
 }
@@ -0,0 +1,314 @@
+#ifndef _perf_counters_h
+#define _perf_counters_h
+
+// Hardware performance counters around code regions (Linux, perf_event_open).
+//
+// Compile with -DPERF_COUNTERS to enable. Without it, the PERF_REGION and
+// PERF_REPORT macros expand to nothing.
+//
+//   PERF_REGION("applyForce4");     // counts the enclosing block
+//   PERF_ATTACH_THREADS();          // opens counters for new threads
+//   PERF_REPORT();                  // prints the counters per region and thread
+//
+// Counters are opened for every thread of the process (found in
+// /proc/self/task), not only for the calling thread, so that the work done by
+// the thread pool of a parallel algorithm is accounted to the region that
+// launched it. A region reads all counters when it is entered and when it is
+// left, and accumulates the differences per thread.
+//
+// Entering and leaving a region costs one read() per counter and nothing else:
+// no allocation, no scan of /proc. The threads are therefore looked for only
+// on the first use, on PERF_ATTACH_THREADS (called by the thread pool when it
+// starts its workers, and by programs after the standard parallel algorithms
+// have started theirs) and on PERF_REPORT. At most maxThreads threads and
+// maxRegions region names are counted.
+//
+// If the kernel refuses the counters (perf_event_paranoid, containers, virtual
+// machines without PMU), the regions still measure the wall-clock time and the
+// report says why the counters are missing. Events that are not supported
+// individually are reported as "n/a".
+//
+// Memory traffic is estimated as 64 bytes per last-level cache miss. There is no
+// portable L2 event: last-level cache references, i.e. L2 misses on most cores,
+// are reported instead.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace perf {
+
+enum Event {
+  Cycles, Instructions, L1DMisses, LLCReferences, LLCMisses, DTLBMisses, BranchMisses, numEvents
+};
+
+inline const std::array<const char*, numEvents> eventNames = {
+  "cycles", "instr", "L1D-miss", "LLC-ref", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+inline perf_event_attr makeAttr(Event e) {
+  auto cache = [](uint64_t id) {
+    return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  };
+  perf_event_attr attr{};
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  switch (e) {
+    case Cycles:        attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case Instructions:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case L1DMisses:     attr.type = PERF_TYPE_HW_CACHE; attr.config = cache(PERF_COUNT_HW_CACHE_L1D); break;
+    case LLCReferences: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+    case LLCMisses:     attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case DTLBMisses:    attr.type = PERF_TYPE_HW_CACHE; attr.config = cache(PERF_COUNT_HW_CACHE_DTLB); break;
+    case BranchMisses:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+    default: break;
+  }
+  return attr;
+}
+
+using Values = std::array<double, numEvents>;
+
+constexpr size_t maxThreads = 128;
+constexpr size_t maxRegions = 128;
+constexpr size_t maxName = 64;
+
+// One set of counters per thread of the process, in the order in which the
+// threads were found.
+class ProcessCounters {
+public:
+  ~ProcessCounters() {
+    for (size_t t = 0; t < count; ++t) {
+      for (int fd: fds[t]) {
+        if (fd >= 0) close(fd);
+      }
+    }
+  }
+
+  bool available() const { return error.empty(); }
+  const std::string& unavailableReason() const { return error; }
+
+  size_t threads() const { return count; }
+  pid_t tid(size_t t) const { return tids[t]; }
+
+  // Opens counters for the threads created since the last call.
+  void refresh() {
+    for (auto& entry: std::filesystem::directory_iterator("/proc/self/task")) {
+      pid_t tid = std::stoi(entry.path().filename().string());
+      if (std::find(tids, tids + count, tid) != tids + count || !available() || count == maxThreads) {
+        continue;
+      }
+      tids[count] = tid;
+      for (int e = 0; e < numEvents; ++e) {
+        auto attr = makeAttr((Event)e);
+        fds[count][e] = (int)syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+        if (fds[count][e] < 0 && e == Cycles && count == 0) {
+          error = std::string("perf_event_open: ") + std::strerror(errno);
+        }
+      }
+      ++count;
+    }
+  }
+
+  // Current counter values of the threads [0, threads()), corrected for
+  // multiplexing. Events that could not be opened read as -1.
+  void read(Values* values) const {
+    for (size_t t = 0; t < count; ++t) {
+      for (int e = 0; e < numEvents; ++e) {
+        uint64_t buf[3] = {};
+        if (fds[t][e] < 0 || ::read(fds[t][e], buf, sizeof(buf)) != sizeof(buf)) {
+          values[t][e] = -1;
+          continue;
+        }
+        values[t][e] = buf[2] == 0 ? 0. : (double)buf[0] * (double)buf[1] / (double)buf[2];
+      }
+    }
+  }
+
+private:
+  pid_t tids[maxThreads] = {};
+  int fds[maxThreads][numEvents] = {};
+  size_t count = 0;
+  std::string error;
+};
+
+struct RegionStats {
+  char name[maxName] = {};
+  uint64_t calls = 0;
+  double seconds = 0;
+  // Indexed like the threads of ProcessCounters; threads() of them are valid.
+  Values perThread[maxThreads] = {};
+  size_t threads = 0;
+
+  // The counts summed over the threads; -1 for events that were not counted.
+  Values total() const {
+    Values sum{};
+    if (threads == 0) {
+      sum.fill(-1);
+    }
+    for (size_t t = 0; t < threads; ++t) {
+      for (int e = 0; e < numEvents; ++e) {
+        sum[e] = (sum[e] < 0 || perThread[t][e] < 0) ? -1 : sum[e] + perThread[t][e];
+      }
+    }
+    return sum;
+  }
+};
+
+class Registry {
+public:
+  static Registry& instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  std::mutex mutex;
+  ProcessCounters counters;
+  // Regions in order of first appearance.
+  RegionStats regions[maxRegions];
+  size_t numRegions = 0;
+  // Regions with more names than maxRegions.
+  RegionStats overflow;
+
+  // Opens counters for the threads created since the last call.
+  void attachThreads() {
+    std::lock_guard lock(mutex);
+    counters.refresh();
+  }
+
+  // The stats of the region `name`, created on first use (the name is cut to
+  // maxName - 1 characters). Does not allocate.
+  RegionStats& stats(std::string_view name) {
+    name = name.substr(0, maxName - 1);
+    for (size_t i = 0; i < numRegions; ++i) {
+      if (name == regions[i].name) return regions[i];
+    }
+    if (numRegions == maxRegions) {
+      return overflow;
+    }
+    RegionStats& s = regions[numRegions++];
+    std::copy(name.begin(), name.end(), s.name);
+    return s;
+  }
+
+  void report(std::ostream& os) {
+    std::lock_guard lock(mutex);
+    counters.refresh();
+    if (!counters.available()) {
+      os << "Hardware counters unavailable (" << counters.unavailableReason()
+         << "), reporting wall-clock time only.\n";
+    }
+    os << std::left << std::setw(24) << "region" << std::right << std::setw(8) << "thread"
+       << std::setw(8) << "calls" << std::setw(11) << "time[ms]" << std::setw(7) << "IPC";
+    for (int e = L1DMisses; e < numEvents; ++e) {
+      os << std::setw(12) << eventNames[e];
+    }
+    os << std::setw(11) << "MB moved" << std::setw(9) << "GB/s" << "\n";
+
+    auto line = [&os](const std::string& name, const std::string& thread, const RegionStats& s, const Values& v) {
+      auto fmt = [](double x, int prec) {
+        std::ostringstream ss;
+        if (x < 0) ss << "n/a";
+        else ss << std::fixed << std::setprecision(prec) << x;
+        return ss.str();
+      };
+      os << std::left << std::setw(24) << name << std::right << std::setw(8) << thread
+         << std::setw(8) << s.calls << std::setw(11) << fmt(s.seconds * 1e3, 2)
+         << std::setw(7) << fmt(v[Cycles] > 0 && v[Instructions] >= 0 ? v[Instructions] / v[Cycles] : -1, 2);
+      for (int e = L1DMisses; e < numEvents; ++e) {
+        os << std::setw(12) << fmt(v[e], 0);
+      }
+      double bytes = v[LLCMisses] < 0 ? -1 : 64. * v[LLCMisses];
+      os << std::setw(11) << fmt(bytes < 0 ? -1 : bytes * 1e-6, 1)
+         << std::setw(9) << fmt(bytes < 0 ? -1 : bytes / s.seconds * 1e-9, 2) << "\n";
+    };
+
+    for (size_t i = 0; i < numRegions; ++i) {
+      const RegionStats& s = regions[i];
+      size_t active = 0;
+      for (size_t t = 0; t < s.threads; ++t) {
+        active += s.perThread[t][Cycles] > 0;
+      }
+      line(s.name, "all", s, s.total());
+      if (active > 1) {
+        for (size_t t = 0; t < s.threads; ++t) {
+          if (s.perThread[t][Cycles] > 0) line("", std::to_string(counters.tid(t)), s, s.perThread[t]);
+        }
+      }
+    }
+  }
+
+private:
+  Registry() { counters.refresh(); }
+};
+
+// Counts the events of all threads between construction and destruction.
+class Region {
+public:
+  explicit Region( std::string_view name ) {
+    auto& r = Registry::instance();
+    std::lock_guard lock(r.mutex);
+    stats = &r.stats(name);
+    threads = r.counters.threads();
+    r.counters.read(start);
+    t0 = std::chrono::steady_clock::now();
+  }
+
+  ~Region() {
+    auto t1 = std::chrono::steady_clock::now();
+    auto& r = Registry::instance();
+    std::lock_guard lock(r.mutex);
+    Values end[maxThreads];
+    r.counters.read(end);
+    ++stats->calls;
+    stats->seconds += std::chrono::duration<double>(t1 - t0).count();
+    // Threads attached inside the region are only counted from the next one.
+    stats->threads = std::max(stats->threads, threads);
+    for (size_t t = 0; t < threads; ++t) {
+      Values& acc = stats->perThread[t];
+      for (int e = 0; e < numEvents; ++e) {
+        double delta = (end[t][e] < 0 || start[t][e] < 0) ? -1 : end[t][e] - start[t][e];
+        acc[e] = (acc[e] < 0 || delta < 0) ? -1 : acc[e] + delta;
+      }
+    }
+  }
+
+  Region(const Region&) = delete;
+  Region& operator=(const Region&) = delete;
+
+private:
+  RegionStats* stats;
+  size_t threads;
+  Values start[maxThreads];
+  std::chrono::steady_clock::time_point t0;
+};
+
+} // namespace perf
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+
+#ifdef PERF_COUNTERS
+#define PERF_REGION(name) ::perf::Region PERF_CONCAT(perfRegion_, __LINE__){name}
+#define PERF_ATTACH_THREADS() ::perf::Registry::instance().attachThreads()
+#define PERF_REPORT() ::perf::Registry::instance().report(std::cout)
+#else
+#define PERF_REGION(name)
+#define PERF_ATTACH_THREADS()
+#define PERF_REPORT()
+#endif
+
+#endif //_perf_counters_h
@@ -0,0 +1,53 @@
+#ifndef _philox_h
+#define _philox_h
+
+// Philox4x32-10 counter-based random number generator (Salmon et al.,
+// "Parallel random numbers: as easy as 1, 2, 3", SC'11).
+//
+// A counter-based generator has no state to advance: the output is a pure
+// function of a key (the seed) and a counter. Value number i can be computed
+// directly, by any thread, in any order, and the sequence does not depend on
+// how the work is split between threads.
+
+#include <array>
+#include <cstdint>
+
+class Philox4x32 {
+public:
+  using Counter = std::array<uint32_t, 4>;
+
+  explicit Philox4x32( uint64_t seed ): key{ (uint32_t)seed, (uint32_t)(seed >> 32) } {}
+
+  // Four independent 32-bit random numbers for the given counter.
+  Counter operator()(Counter c) const {
+    std::array<uint32_t, 2> k = key;
+    for (int round = 0; round < 10; ++round) {
+      uint64_t p0 = (uint64_t)M0 * c[0];
+      uint64_t p1 = (uint64_t)M1 * c[2];
+      c = { (uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (uint32_t)p1,
+            (uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (uint32_t)p0 };
+      k[0] += W0;
+      k[1] += W1;
+    }
+    return c;
+  }
+
+  // Four floats uniformly distributed in [lo, hi), for element i and
+  // sub-stream j (use one j per group of four values needed by an element).
+  std::array<float, 4> uniform4(uint64_t i, uint32_t j, float lo, float hi) const {
+    Counter r = (*this)({ (uint32_t)i, (uint32_t)(i >> 32), j, 0 });
+    std::array<float, 4> u;
+    for (int k = 0; k < 4; ++k) {
+      // The 24 high bits give every float in [0, 1) with a 2^-24 spacing.
+      u[k] = lo + (hi - lo) * ((r[k] >> 8) * 0x1p-24f);
+    }
+    return u;
+  }
+
+private:
+  static constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+  static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+  std::array<uint32_t, 2> key;
+};
+
+#endif //_philox_h
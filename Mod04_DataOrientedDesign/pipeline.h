@@ -0,0 +1,163 @@
+#ifndef _pipeline_h
+#define _pipeline_h
+
+// Fused sweeps: several element-wise updates and reductions over the same
+// arrays, executed as one parallel pass over the memory.
+//
+//   auto [energy, left] = sweep(n)
+//       .update([&](size_t i) { ... modifies element i ... })
+//       .sum([&](size_t i) { return kinetic energy of i; })
+//       .reduce(inf, [&](size_t i) { return posx[i]; }, minimum)
+//       .run();
+//
+// Building the pipeline does nothing; run() executes it. The range [0, n) is
+// cut into the fixed blocks of reproducibleSum (see reduction.h), the blocks
+// are split between the threads as by parallelFor, and each block is processed
+// in tiles of `tileSize` elements: every stage runs over the tile, in the order
+// in which the stages were added, before the next tile is loaded. The stages
+// of a tile therefore read the arrays from the cache instead of from DRAM,
+// each stage is a simple loop that the compiler can vectorise, and a stage
+// sees the elements as left by the previous stages.
+//
+// Stages must be element-wise: stage k may only access element i when called
+// for i. run() returns the results of the reductions, in order, as a tuple.
+// The partial results of the chunks are combined in chunk order. A sum adds its
+// terms in the lanes and blocks of reproducibleSum, so it is the same, bit for
+// bit, as reproducibleSum of the same values, whatever the number of threads.
+
+#include <algorithm>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "parallel.h"
+#include "reduction.h"
+
+namespace pipeline_detail {
+
+template<class F>
+struct Update {
+  F f;
+  struct Accumulator {};
+
+  Accumulator init() const { return {}; }
+  void apply(size_t first, size_t last, Accumulator&) const {
+    for (size_t i = first; i < last; ++i) f(i);
+  }
+  static void endBlock(Accumulator&) {}
+  static Accumulator combine(Accumulator a, Accumulator) { return a; }
+  static std::tuple<> result(Accumulator) { return {}; }
+};
+
+template<class T, class Value, class Combine>
+struct Reduction {
+  T initial;
+  Value value;
+  Combine combiner;
+  using Accumulator = T;
+
+  T init() const { return initial; }
+  // The tile is folded in independent lanes, as by the reductions of reduction.h.
+  void apply(size_t first, size_t last, T& acc) const {
+    acc = combiner(acc, reduction_detail::laneFold(first, last, initial, value, combiner));
+  }
+  static void endBlock(T&) {}
+  T combine(const T& a, const T& b) const { return combiner(a, b); }
+  static std::tuple<T> result(const T& acc) { return { acc }; }
+};
+
+template<class Value>
+struct Sum {
+  Value value;
+  // The lanes of the current block, and the sums of the blocks done, in order.
+  struct Accumulator {
+    double part[reduction_detail::lanes] = {};
+    std::vector<double> blocks;
+  };
+
+  Accumulator init() const { return {}; }
+  // The tiles start at multiples of the lanes, as the blocks of reproducibleSum.
+  void apply(size_t first, size_t last, Accumulator& acc) const {
+    reduction_detail::addTerms(first, last, value, acc.part);
+  }
+  static void endBlock(Accumulator& acc) {
+    acc.blocks.push_back(reduction_detail::pairwiseSum(acc.part, reduction_detail::lanes));
+    std::fill_n(acc.part, reduction_detail::lanes, 0.0);
+  }
+  static Accumulator combine(Accumulator a, const Accumulator& b) {
+    a.blocks.insert(a.blocks.end(), b.blocks.begin(), b.blocks.end());
+    return a;
+  }
+  static std::tuple<float> result(const Accumulator& acc) {
+    return { float(reduction_detail::pairwiseSum(acc.blocks.data(), acc.blocks.size())) };
+  }
+};
+
+} // namespace pipeline_detail
+
+template<class... Stages>
+class Sweep {
+public:
+  static constexpr size_t tileSize = 2048;
+  static_assert(reduction_detail::blockSize % tileSize == 0, "a tile must not straddle two blocks");
+
+  Sweep( size_t _n, std::tuple<Stages...> _stages ): n(_n), stages(std::move(_stages)) {}
+
+  // Adds a stage that calls f(i) for every element i.
+  template<class F>
+  Sweep<Stages..., pipeline_detail::Update<F>> update(F f) && {
+    return { n, std::tuple_cat(std::move(stages), std::tuple(pipeline_detail::Update<F>{ f })) };
+  }
+
+  // Adds a stage that folds value(i) over the elements with combine, starting
+  // from init in each chunk. init must be neutral for combine.
+  template<class T, class Value, class Combine>
+  Sweep<Stages..., pipeline_detail::Reduction<T, Value, Combine>> reduce(T init, Value value, Combine combine) && {
+    return { n, std::tuple_cat(std::move(stages),
+                               std::tuple(pipeline_detail::Reduction<T, Value, Combine>{ init, value, combine })) };
+  }
+
+  // Adds a stage that sums value(i) over the elements, as reproducibleSum.
+  template<class Value>
+  Sweep<Stages..., pipeline_detail::Sum<Value>> sum(Value value) && {
+    return { n, std::tuple_cat(std::move(stages), std::tuple(pipeline_detail::Sum<Value>{ value })) };
+  }
+
+  auto run() const {
+    return runStages(std::index_sequence_for<Stages...>{});
+  }
+
+private:
+  template<size_t... K>
+  auto runStages(std::index_sequence<K...>) const {
+    using Accumulators = std::tuple<typename Stages::Accumulator...>;
+    Accumulators init { std::get<K>(stages).init()... };
+    using reduction_detail::blockSize;
+    const size_t blocks = (n + blockSize - 1) / blockSize;
+    Accumulators total = parallelReduce(blocks, init, [&](size_t first, size_t last) {
+      Accumulators acc = init;
+      for (size_t b = first; b < last; ++b) {
+        const size_t blockEnd = std::min(n, (b + 1) * blockSize);
+        for (size_t tile = b * blockSize; tile < blockEnd; tile += tileSize) {
+          size_t end = std::min(blockEnd, tile + tileSize);
+          (std::get<K>(stages).apply(tile, end, std::get<K>(acc)), ...);
+        }
+        (std::get<K>(stages).endBlock(std::get<K>(acc)), ...);
+      }
+      return acc;
+    }, [this](const Accumulators& a, const Accumulators& b) {
+      return Accumulators { std::get<K>(stages).combine(std::get<K>(a), std::get<K>(b))... };
+    });
+    return std::tuple_cat(std::get<K>(stages).result(std::get<K>(total))...);
+  }
+
+  size_t n;
+  std::tuple<Stages...> stages;
+};
+
+// An empty pipeline over the elements [0, n).
+inline Sweep<> sweep(size_t n) {
+  return { n, {} };
+}
+
+#endif //_pipeline_h
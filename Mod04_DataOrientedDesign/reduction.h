@@ -0,0 +1,151 @@
+#ifndef _reduction_h
+#define _reduction_h
+
+// Parallel reductions whose result does not depend on the number of threads.
+//
+// reproducibleSum(n, value) returns the sum of value(i) for i in [0, n). The
+// range is cut into blocks of a fixed size, independent of the number of
+// threads. Each block is summed by 16 interleaved double accumulators, which
+// the compiler keeps in SIMD registers, and the accumulators and then the
+// block sums are added by pairwise (tree) summation. Every addition therefore
+// happens in the same order whatever the number of threads, and the result is
+// bit-for-bit the same. With double accumulators and short dependency chains
+// the error is that of rounding the exact sum to float; a float accumulated
+// over 1e8 terms can be off in its third digit.
+//
+// reproducibleSumLanes(n, addTerms) is the same sum for layouts whose terms are
+// cheaper to compute a tile at a time (the blocks of an AoSoA): addTerms(first,
+// last, lane) adds the term i to lane[i % sumLanes] for i in [first, last).
+// reproducibleSumDouble returns the sum before it is rounded to float, for
+// callers that add several ranges (the chunks of a column store).
+//
+// reproducibleMin and reproducibleMax start from +inf and -inf, so that any
+// value, including the first one, can be the result, and the result of an empty
+// range is the identity. min and max are exact, so any order gives the same
+// result.
+//
+// rangeMin and rangeMax are the same folds over [first, last) on the calling
+// thread, for code that already splits the work itself (the blocks of a zone
+// map, the tiles of a pipeline).
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "parallel.h"
+
+namespace reduction_detail {
+
+constexpr size_t blockSize = 4096;
+constexpr size_t lanes = 16;
+
+inline double pairwiseSum(const double* p, size_t n) {
+  if (n <= 4) {
+    double s = 0;
+    for (size_t i = 0; i < n; ++i) s += p[i];
+    return s;
+  }
+  size_t half = n / 2;
+  return pairwiseSum(p, half) + pairwiseSum(p + half, n - half);
+}
+
+// The blocks start at multiples of `lanes`, so part[k] takes the terms i with
+// i % lanes == k.
+template<class Value>
+void addTerms(size_t first, size_t last, const Value& value, double* part) {
+  size_t i = first;
+  for (; i + lanes <= last; i += lanes) {
+    for (size_t k = 0; k < lanes; ++k) part[k] += value(i + k);
+  }
+  for (size_t k = 0; i < last; ++i, ++k) part[k] += value(i);
+}
+
+template<class AddTerms>
+double sumBlocks(size_t n, const AddTerms& add) {
+  const size_t blocks = (n + blockSize - 1) / blockSize;
+  std::vector<double> partial(blocks);
+  parallelFor(blocks, [&](size_t first, size_t last) {
+    for (size_t b = first; b < last; ++b) {
+      double part[lanes] = {};
+      add(b * blockSize, std::min(n, (b + 1) * blockSize), part);
+      partial[b] = pairwiseSum(part, lanes);
+    }
+  });
+  return pairwiseSum(partial.data(), blocks);
+}
+
+// Folds value(i) over [first, last) into `lanes` independent partial results,
+// which the compiler keeps in SIMD registers instead of waiting on a single
+// dependency chain, then folds the lanes. identity must be neutral for combine.
+template<class T, class Value, class Combine>
+T laneFold(size_t first, size_t last, T identity, const Value& value, const Combine& combine) {
+  T part[lanes];
+  std::fill_n(part, lanes, identity);
+  size_t i = first;
+  for (; i + lanes <= last; i += lanes) {
+    for (size_t k = 0; k < lanes; ++k) part[k] = combine(part[k], T(value(i + k)));
+  }
+  for (; i < last; ++i) part[0] = combine(part[0], T(value(i)));
+  return std::accumulate(part, part + lanes, identity, combine);
+}
+
+constexpr float minIdentity = std::numeric_limits<float>::infinity();
+constexpr float maxIdentity = -std::numeric_limits<float>::infinity();
+inline float pickMin(float x, float m) { return x < m ? x : m; }
+inline float pickMax(float x, float m) { return x > m ? x : m; }
+
+template<class Value, class Pick>
+float extremum(size_t n, float identity, const Value& value, Pick pick) {
+  return parallelReduce(n, identity, [&](size_t first, size_t last) {
+    return laneFold(first, last, identity, value, pick);
+  }, pick);
+}
+
+} // namespace reduction_detail
+
+constexpr size_t sumLanes = reduction_detail::lanes;
+
+template<class Value>
+double reproducibleSumDouble(size_t n, const Value& value) {
+  using namespace reduction_detail;
+  return sumBlocks(n, [&](size_t first, size_t last, double* part) {
+    addTerms(first, last, value, part);
+  });
+}
+
+template<class Value>
+float reproducibleSum(size_t n, const Value& value) {
+  return float(reproducibleSumDouble(n, value));
+}
+
+template<class AddTerms>
+float reproducibleSumLanes(size_t n, const AddTerms& addTerms) {
+  return float(reduction_detail::sumBlocks(n, addTerms));
+}
+
+template<class Value>
+float reproducibleMin(size_t n, const Value& value) {
+  using namespace reduction_detail;
+  return extremum(n, minIdentity, value, pickMin);
+}
+
+template<class Value>
+float reproducibleMax(size_t n, const Value& value) {
+  using namespace reduction_detail;
+  return extremum(n, maxIdentity, value, pickMax);
+}
+
+template<class Value>
+float rangeMin(size_t first, size_t last, const Value& value) {
+  using namespace reduction_detail;
+  return laneFold(first, last, minIdentity, value, pickMin);
+}
+
+template<class Value>
+float rangeMax(size_t first, size_t last, const Value& value) {
+  using namespace reduction_detail;
+  return laneFold(first, last, maxIdentity, value, pickMax);
+}
+
+#endif //_reduction_h
@@ -0,0 +1,580 @@
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "parallel.h"
+#include "bench.h"
+#include "cache_info.h"
+
+using namespace std;
+
+// The roofline of this machine (see Mod03_Memory/12_RooflinePerformance.md),
+// and the kernels of SOA.cpp and particle.cpp placed on it.
+//
+// The roofs are measured, not taken from a data sheet:
+//
+//  - the peak FLOP/s, with 12 independent chains of FMAs (enough to hide the
+//    latency of the FMA units) in scalar, AVX2 and AVX-512 code. Each variant
+//    is compiled for its own instruction set with a target attribute and only
+//    runs if the CPU supports it, so the binary does not need -march=native.
+//  - the bandwidth of each level of the memory hierarchy, with the four STREAM
+//    kernels (copy, scale, add, triad) on three float arrays whose total size
+//    is half of the cache of that level, or at least 4 times the last-level
+//    cache for DRAM (capped by --max-mb). The best of the four kernels is the
+//    roof of the level. Each thread sweeps its own chunk of the arrays, without
+//    synchronisation between sweeps, so that even L1-sized arrays are measured
+//    and not the wake-up of the thread pool.
+//
+// Both are measured on one thread and on all hardware threads. The cache
+// sizes come from cache_info.h.
+//
+// The kernels are read from CSV files with a header line: those written by
+// `soa --csv file` (bench.h), and by `particle --csv file`. The columns used
+// are kernel, layout, n, threads, gflops, bytes_per_particle and
+// flops_per_particle. The arithmetic intensity of a kernel is its useful
+// flops per useful byte, and its roof is min(peak, intensity * bandwidth of
+// the level in which n * bytes_per_particle fits), for its number of threads.
+// n * bytes_per_particle is the data that a call moves, an upper bound of its
+// working set: a kernel that reuses its data from the cache (temporal
+// blocking) or skips it (zone maps) can be placed too low in the hierarchy,
+// and land above its roof. Kernels without flops (construct, the sorts) have no
+// place on the plot.
+//
+// The intensity is therefore declared by the kernels, not measured: the bytes
+// are those the code asks for, not the traffic that reaches the memory. The
+// traffic of a kernel (read-for-ownership of the stores, whole cache lines of
+// a strided layout, hardware prefetch) is what `soa` reports when compiled
+// with -DPERF_COUNTERS, as 64 bytes per last-level cache miss (see
+// perf_counters.h). Counters are not available on every machine (containers,
+// virtual machines), so the plot does not depend on them. A kernel whose
+// real traffic exceeds its declared bytes sits further below its roof than
+// the plot shows.
+//
+// Usage: roofline [--output roofline] [--max-mb 1024] [--min-time 0.05] [file.csv ...]
+//
+// writes roofline.csv (every roof and every kernel, with its roof and the
+// fraction of it that it reaches) and roofline.svg (the log-log plot).
+//
+// Example:
+//   g++ -std=c++20 -O3 -march=native -pthread -o roofline roofline.cpp
+//   ./soa --sizes 1e3,1e5,1e7 --csv soa.csv
+//   ./particle --csv particle.csv
+//   ./roofline soa.csv particle.csv
+
+constexpr int chains = 12;
+
+// Measured value of a roof, on one thread and on all hardware threads.
+struct Roof {
+    string name;
+    double single;
+    double all;
+
+    // The roof for `threads` threads, interpolated linearly between one thread
+    // and all threads.
+    double at(unsigned threads) const {
+        return threads <= 1 ? single : min(all, single * threads);
+    }
+};
+
+// A kernel read from a CSV file, placed on the roofline.
+struct KernelPoint {
+    string name;
+    size_t n;
+    unsigned threads;
+    double gflops;
+    double bytesPerParticle;
+    double intensity;
+    string level;
+    double roof;
+    bool memoryBound;
+};
+
+using Clock = chrono::steady_clock;
+
+double secondsSince(Clock::time_point t0) {
+    return chrono::duration<double>(Clock::now() - t0).count();
+}
+
+//// PEAK FLOP/S ////
+
+/* Each function runs `iterations` times one FMA in each of the `chains`
+ * independent accumulators and returns a value that depends on all of them.
+ * The multiplier is slightly below 1 so that the accumulators neither
+ * overflow nor become denormals.
+ */
+float fmaGeneric( size_t iterations, float seed ) {
+    float acc[chains];
+    for( int k = 0; k < chains; k++ ) acc[k] = seed + k;
+    for( size_t i = 0; i < iterations; i++ ) {
+        for( int k = 0; k < chains; k++ ) acc[k] = fmaf(acc[k], 0.999999f, 1e-7f);
+    }
+    float s = 0;
+    for( int k = 0; k < chains; k++ ) s += acc[k];
+    return s;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("fma")))
+float fmaScalar( size_t iterations, float seed ) {
+    __m128 acc[chains];
+    for( int k = 0; k < chains; k++ ) acc[k] = _mm_set_ss(seed + k);
+    const __m128 a = _mm_set_ss(0.999999f), b = _mm_set_ss(1e-7f);
+    for( size_t i = 0; i < iterations; i++ ) {
+        for( int k = 0; k < chains; k++ ) acc[k] = _mm_fmadd_ss(acc[k], a, b);
+    }
+    for( int k = 1; k < chains; k++ ) acc[0] = _mm_add_ss(acc[0], acc[k]);
+    return _mm_cvtss_f32(acc[0]);
+}
+
+__attribute__((target("avx2,fma")))
+float fmaAvx2( size_t iterations, float seed ) {
+    __m256 acc[chains];
+    for( int k = 0; k < chains; k++ ) acc[k] = _mm256_set1_ps(seed + k);
+    const __m256 a = _mm256_set1_ps(0.999999f), b = _mm256_set1_ps(1e-7f);
+    for( size_t i = 0; i < iterations; i++ ) {
+        for( int k = 0; k < chains; k++ ) acc[k] = _mm256_fmadd_ps(acc[k], a, b);
+    }
+    for( int k = 1; k < chains; k++ ) acc[0] = _mm256_add_ps(acc[0], acc[k]);
+    return _mm256_cvtss_f32(acc[0]);
+}
+
+__attribute__((target("avx512f")))
+float fmaAvx512( size_t iterations, float seed ) {
+    __m512 acc[chains];
+    for( int k = 0; k < chains; k++ ) acc[k] = _mm512_set1_ps(seed + k);
+    const __m512 a = _mm512_set1_ps(0.999999f), b = _mm512_set1_ps(1e-7f);
+    for( size_t i = 0; i < iterations; i++ ) {
+        for( int k = 0; k < chains; k++ ) acc[k] = _mm512_fmadd_ps(acc[k], a, b);
+    }
+    for( int k = 1; k < chains; k++ ) acc[0] = _mm512_add_ps(acc[0], acc[k]);
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, acc[0]);
+    return accumulate(lanes, lanes + 16, 0.f);
+}
+#endif
+
+struct FmaVariant {
+    const char* name;
+    int lanes;
+    float (*run)(size_t, float);
+};
+
+/* The variants that the CPU can run. "generic" is plain C++, compiled with
+ * the flags of the build: scalar FMAs, or vector FMAs if the compiler manages
+ * to vectorise the chains.
+ */
+vector<FmaVariant> fmaVariants() {
+    vector<FmaVariant> variants;
+#if defined(__x86_64__) || defined(__i386__)
+    if( __builtin_cpu_supports("fma") ) {
+        variants.push_back({ "scalar", 1, fmaScalar });
+    }
+    if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) {
+        variants.push_back({ "avx2", 8, fmaAvx2 });
+    }
+    if( __builtin_cpu_supports("avx512f") ) {
+        variants.push_back({ "avx512", 16, fmaAvx512 });
+    }
+#endif
+    if( variants.empty() ) {
+        variants.push_back({ "generic", 1, fmaGeneric });
+    }
+    return variants;
+}
+
+/* GFLOP/s of a variant on the current number of threads: every thread runs
+ * the same number of iterations, calibrated so that a run lasts minTime.
+ */
+double measurePeak( const FmaVariant& v, double minTime ) {
+    const unsigned threads = numThreads();
+    auto run = [&]( size_t iterations ) {
+        auto t0 = Clock::now();
+        parallelFor(threads, [&]( size_t first, size_t ) {
+            doNotOptimize(v.run(iterations, float(first)));
+        });
+        return secondsSince(t0);
+    };
+    size_t iterations = 1 << 16;
+    double seconds = run(iterations);
+    while( seconds < minTime / 4 ) {
+        iterations *= 4;
+        seconds = run(iterations);
+    }
+    iterations = size_t(iterations * minTime / seconds) + 1;
+    double best = 0;
+    for( int rep = 0; rep < 3; rep++ ) {
+        double flops = 2.0 * chains * v.lanes * iterations * threads;
+        best = max(best, flops / run(iterations) * 1e-9);
+    }
+    return best;
+}
+
+//// BANDWIDTH ////
+
+/* The STREAM kernels, on floats: bytes read and written, and flops, per
+ * element. Writes are counted once, as in STREAM, although a store that
+ * misses the cache usually reads the line first.
+ */
+struct StreamKernel {
+    const char* name;
+    double bytes;
+    double flops;
+    void (*run)(float* __restrict a, const float* __restrict b, const float* __restrict c,
+                size_t first, size_t last);
+};
+
+const float scalar = 3.f;
+
+const array<StreamKernel, 4> streamKernels {{
+    { "copy", 8, 0, []( float* __restrict a, const float* __restrict b, const float* __restrict,
+                        size_t first, size_t last ) {
+        for( size_t i = first; i < last; i++ ) a[i] = b[i];
+    } },
+    { "scale", 8, 1, []( float* __restrict a, const float* __restrict b, const float* __restrict,
+                         size_t first, size_t last ) {
+        for( size_t i = first; i < last; i++ ) a[i] = scalar * b[i];
+    } },
+    { "add", 12, 1, []( float* __restrict a, const float* __restrict b, const float* __restrict c,
+                        size_t first, size_t last ) {
+        for( size_t i = first; i < last; i++ ) a[i] = b[i] + c[i];
+    } },
+    { "triad", 12, 2, []( float* __restrict a, const float* __restrict b, const float* __restrict c,
+                          size_t first, size_t last ) {
+        for( size_t i = first; i < last; i++ ) a[i] = b[i] + scalar * c[i];
+    } },
+}};
+
+/* GB/s of each STREAM kernel on three arrays of `bytes` bytes in total, on the
+ * current number of threads. The arrays are first touched by the threads that
+ * use them. Each sample repeats the kernel `calls` times on every thread; the
+ * best of 5 samples is kept, as in STREAM.
+ */
+array<double, 4> measureBandwidth( size_t bytes, double minTime ) {
+    const size_t n = max<size_t>(bytes / (3 * sizeof(float)), 64 * numThreads());
+    unique_ptr<float[]> a(new float[n]), b(new float[n]), c(new float[n]);
+    parallelFor(n, [&]( size_t first, size_t last ) {
+        fill(a.get() + first, a.get() + last, 0.f);
+        fill(b.get() + first, b.get() + last, 1.f);
+        fill(c.get() + first, c.get() + last, 2.f);
+    });
+    array<double, 4> gbPerSecond {};
+    for( size_t k = 0; k < streamKernels.size(); k++ ) {
+        const StreamKernel& kernel = streamKernels[k];
+        auto sample = [&]( size_t calls ) {
+            auto t0 = Clock::now();
+            parallelFor(n, [&]( size_t first, size_t last ) {
+                for( size_t call = 0; call < calls; call++ ) {
+                    kernel.run(a.get(), b.get(), c.get(), first, last);
+                    doNotOptimize(a[first]);
+                }
+            });
+            return secondsSince(t0);
+        };
+        size_t calls = max<size_t>(1, size_t(minTime / max(sample(1), 1e-9)));
+        double best = 0;
+        for( int rep = 0; rep < 5; rep++ ) {
+            best = max(best, kernel.bytes * n * calls / sample(calls) * 1e-9);
+        }
+        gbPerSecond[k] = best;
+    }
+    return gbPerSecond;
+}
+
+/* Total size of the arrays measuring `level` on `threads` threads: half of
+ * the capacity of the instances of the cache that the threads use.
+ */
+size_t streamBytes( const CacheLevel& level, unsigned threads ) {
+    const unsigned instances = max(1u, thread::hardware_concurrency() / level.sharers);
+    const unsigned used = min(instances, max(1u, threads / level.sharers));
+    return level.bytes * used / 2;
+}
+
+//// KERNELS ////
+
+vector<string> splitCsvLine( const string& line ) {
+    vector<string> fields;
+    stringstream ss(line);
+    for( string field; getline(ss, field, ','); ) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+/* The kernels of a CSV file with a header line. Rows without flops, or from
+ * a file without the needed columns, are skipped.
+ */
+vector<KernelPoint> readKernels( const string& fileName ) {
+    ifstream ifile(fileName);
+    string line;
+    if( !ifile || !getline(ifile, line) ) {
+        cerr << "Cannot read " << fileName << endl;
+        return {};
+    }
+    map<string, size_t> column;
+    auto header = splitCsvLine(line);
+    for( size_t i = 0; i < header.size(); i++ ) {
+        column[header[i]] = i;
+    }
+    for( const char* name: { "kernel", "layout", "n", "threads", "gflops", "bytes_per_particle", "flops_per_particle" } ) {
+        if( !column.count(name) ) {
+            cerr << fileName << " has no column " << name << endl;
+            return {};
+        }
+    }
+    vector<KernelPoint> kernels;
+    while( getline(ifile, line) ) {
+        auto f = splitCsvLine(line);
+        if( f.size() < header.size() ) {
+            continue;
+        }
+        const double bytes = stod(f[column["bytes_per_particle"]]);
+        const double flops = stod(f[column["flops_per_particle"]]);
+        if( flops <= 0 || bytes <= 0 ) {
+            continue;
+        }
+        KernelPoint k;
+        k.name = f[column["kernel"]] + " " + f[column["layout"]];
+        k.n = stoull(f[column["n"]]);
+        k.threads = stoul(f[column["threads"]]);
+        k.gflops = stod(f[column["gflops"]]);
+        k.bytesPerParticle = bytes;
+        k.intensity = flops / bytes;
+        kernels.push_back(k);
+    }
+    return kernels;
+}
+
+//// OUTPUT ////
+
+/* A log-log plot: the bandwidth roofs as diagonals up to the best peak, the
+ * peaks as horizontal lines, the kernels as points. Roofs measured on one
+ * thread are dashed when the machine has several.
+ */
+void writeSvg( const string& fileName, const vector<Roof>& peaks, const vector<Roof>& bandwidths,
+               const vector<KernelPoint>& kernels ) {
+    const unsigned hw = thread::hardware_concurrency();
+    double bestPeak = 0, bestSinglePeak = 0, minBandwidth = 1e300;
+    for( auto& p: peaks ) bestPeak = max(bestPeak, p.all);
+    for( auto& p: peaks ) bestSinglePeak = max(bestSinglePeak, p.single);
+    for( auto& b: bandwidths ) minBandwidth = min(minBandwidth, b.single);
+
+    double xMin = 1. / 16, xMax = 64, yMin = minBandwidth * xMin, yMax = bestPeak * 2;
+    for( auto& k: kernels ) {
+        xMin = min(xMin, k.intensity);
+        xMax = max(xMax, k.intensity);
+        yMin = min(yMin, k.gflops);
+        yMax = max(yMax, k.gflops * 2);
+    }
+    xMin = exp2(floor(log2(xMin)));
+    xMax = exp2(ceil(log2(xMax)));
+    yMin = pow(10, floor(log10(yMin)));
+    yMax = pow(10, ceil(log10(yMax)));
+
+    const double width = 900, height = 600, left = 70, right = 130, top = 30, bottom = 50;
+    auto x = [&]( double ai ) { return left + (width - left - right) * log(ai / xMin) / log(xMax / xMin); };
+    auto y = [&]( double g ) { return height - bottom - (height - top - bottom) * log(g / yMin) / log(yMax / yMin); };
+    auto tick = []( double v ) {
+        ostringstream ss;
+        ss << v;
+        return ss.str();
+    };
+    const array<const char*, 6> colors { "#1f77b4", "#2ca02c", "#ff7f0e", "#d62728", "#9467bd", "#8c564b" };
+
+    ofstream svg(fileName);
+    svg << fixed << setprecision(1);
+    svg << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height
+        << "\" font-family=\"sans-serif\" font-size=\"11\">\n"
+        << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+    for( double ai = xMin; ai <= xMax * 1.001; ai *= 2 ) {
+        svg << "<line x1=\"" << x(ai) << "\" y1=\"" << top << "\" x2=\"" << x(ai) << "\" y2=\"" << height - bottom
+            << "\" stroke=\"#eee\"/>\n<text x=\"" << x(ai) << "\" y=\"" << height - bottom + 15
+            << "\" text-anchor=\"middle\">" << tick(ai) << "</text>\n";
+    }
+    for( double g = yMin; g <= yMax * 1.001; g *= 10 ) {
+        svg << "<line x1=\"" << left << "\" y1=\"" << y(g) << "\" x2=\"" << width - right << "\" y2=\"" << y(g)
+            << "\" stroke=\"#eee\"/>\n<text x=\"" << left - 5 << "\" y=\"" << y(g) + 4
+            << "\" text-anchor=\"end\">" << tick(g) << "</text>\n";
+    }
+    svg << "<text x=\"" << (left + width - right) / 2 << "\" y=\"" << height - 12
+        << "\" text-anchor=\"middle\">arithmetic intensity [flop/byte]</text>\n"
+        << "<text transform=\"translate(16," << (top + height - bottom) / 2
+        << ") rotate(-90)\" text-anchor=\"middle\">GFLOP/s</text>\n";
+
+    auto roofLines = [&]( bool all ) {
+        const char* dash = all ? "" : " stroke-dasharray=\"6,4\"";
+        const char* suffix = all && hw > 1 ? " (all)" : hw > 1 ? " (1 thread)" : "";
+        const double top = all ? bestPeak : bestSinglePeak;
+        for( size_t i = 0; i < bandwidths.size(); i++ ) {
+            const double bw = all ? bandwidths[i].all : bandwidths[i].single;
+            const double ridge = top / bw;
+            svg << "<line x1=\"" << x(xMin) << "\" y1=\"" << y(bw * xMin) << "\" x2=\"" << x(ridge) << "\" y2=\""
+                << y(top) << "\" stroke=\"" << colors[i % colors.size()] << "\"" << dash << "/>\n"
+                << "<text x=\"" << x(xMin) + 4 << "\" y=\"" << y(bw * xMin) - 4 << "\" fill=\""
+                << colors[i % colors.size()] << "\">" << bandwidths[i].name << " " << bw << " GB/s" << suffix << "</text>\n";
+        }
+        for( auto& p: peaks ) {
+            const double g = all ? p.all : p.single;
+            svg << "<line x1=\"" << left << "\" y1=\"" << y(g) << "\" x2=\"" << width - right << "\" y2=\"" << y(g)
+                << "\" stroke=\"black\"" << dash << "/>\n<text x=\"" << width - right + 4 << "\" y=\"" << y(g) + 4
+                << "\">" << p.name << " " << g << suffix << "</text>\n";
+        }
+    };
+    roofLines(true);
+    if( hw > 1 ) {
+        roofLines(false);
+    }
+    for( auto& k: kernels ) {
+        svg << "<circle cx=\"" << x(k.intensity) << "\" cy=\"" << y(k.gflops) << "\" r=\"3.5\" fill=\""
+            << (k.memoryBound ? "#d62728" : "#1f77b4") << "\"><title>" << k.name << " n=" << k.n << " threads="
+            << k.threads << "</title></circle>\n<text x=\"" << x(k.intensity) + 5 << "\" y=\"" << y(k.gflops) + 3
+            << "\" font-size=\"9\">" << k.name << " " << k.n << "</text>\n";
+    }
+    svg << "</svg>\n";
+}
+
+int main( int argc, char* argv[] ) {
+    string output = "roofline";
+    double maxBytes = 1024. * (1 << 20);
+    double minTime = 0.05;
+    vector<string> inputs;
+    for( int i = 1; i < argc; i++ ) {
+        string arg = argv[i];
+        if( arg.rfind("--", 0) != 0 ) {
+            inputs.push_back(arg);
+            continue;
+        }
+        if( i + 1 == argc ) {
+            cerr << "Missing value for " << arg << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        if( arg == "--output" ) output = value;
+        else if( arg == "--max-mb" ) maxBytes = stod(value) * (1 << 20);
+        else if( arg == "--min-time" ) minTime = stod(value);
+        else cerr << "Ignoring unknown option " << arg << endl;
+    }
+
+    const unsigned hw = thread::hardware_concurrency();
+    const vector<unsigned> threadCounts = hw > 1 ? vector<unsigned>{ 1, hw } : vector<unsigned>{ 1 };
+    auto measure = [&]( const string& name, auto f ) {
+        Roof roof { name, 0, 0 };
+        for( unsigned t: threadCounts ) {
+            setNumThreads(t);
+            (t == 1 ? roof.single : roof.all) = f(t);
+        }
+        if( hw == 1 ) {
+            roof.all = roof.single;
+        }
+        return roof;
+    };
+
+    cout << fixed << setprecision(2);
+    cout << left << setw(12) << "peak" << right << setw(14) << "GFLOP/s/core" << setw(14) << "GFLOP/s" << endl;
+    vector<Roof> peaks;
+    for( auto& v: fmaVariants() ) {
+        peaks.push_back(measure(v.name, [&]( unsigned ) { return measurePeak(v, minTime); }));
+        cout << left << setw(12) << v.name << right << setw(14) << peaks.back().single << setw(14) << peaks.back().all << endl;
+    }
+
+    // Bandwidth roofs: the caches, and DRAM with at least 4x the last level.
+    auto levels = cacheLevels();
+    const size_t llc = levels.back().bytes * max(1u, hw / levels.back().sharers);
+    const size_t dramBytes = (size_t)min(maxBytes, max(4. * llc, 64. * (1 << 20)));
+    if( dramBytes < 4 * llc ) {
+        cerr << "The DRAM arrays (" << (dramBytes >> 20) << " MB, see --max-mb) are less than 4 times the "
+             << "last-level cache (" << (llc >> 20) << " MB): the DRAM bandwidth may be overestimated" << endl;
+    }
+    cout << "\n" << left << setw(8) << "level" << right << setw(12) << "bytes" << setw(5) << "thr";
+    for( auto& k: streamKernels ) cout << setw(10) << k.name;
+    cout << setw(10) << "GB/s" << endl;
+    vector<Roof> bandwidths;
+    vector<string> bandwidthRows;
+    for( size_t l = 0; l <= levels.size(); l++ ) {
+        const bool dram = l == levels.size();
+        const string name = dram ? "DRAM" : levels[l].name;
+        bandwidths.push_back(measure(name, [&]( unsigned t ) {
+            const size_t bytes = dram ? dramBytes : streamBytes(levels[l], t);
+            auto gb = measureBandwidth(bytes, minTime);
+            for( size_t k = 0; k < gb.size(); k++ ) {
+                stringstream row;
+                row << scientific << setprecision(6) << "bandwidth," << streamKernels[k].name << "," << name << ","
+                    << t << ",," << bytes << "," << streamKernels[k].flops / streamKernels[k].bytes << ","
+                    << gb[k] * streamKernels[k].flops / streamKernels[k].bytes << "," << gb[k] << ",,,\n";
+                bandwidthRows.push_back(row.str());
+            }
+            cout << left << setw(8) << name << right << setw(12) << bytes << setw(5) << t;
+            for( double g: gb ) cout << setw(10) << g;
+            cout << setw(10) << *max_element(gb.begin(), gb.end()) << endl;
+            return *max_element(gb.begin(), gb.end());
+        }));
+    }
+
+    // The level of a kernel is the first one whose arrays, on the threads of
+    // the kernel, are at least as large as the data that the kernel touches.
+    // The compute roof is the best variant on each number of threads, which
+    // need not be the same on one thread and on all of them.
+    auto peakAt = [&peaks]( unsigned threads ) {
+        double best = 0;
+        for( auto& p: peaks ) best = max(best, p.at(threads));
+        return best;
+    };
+    vector<KernelPoint> kernels;
+    for( auto& fileName: inputs ) {
+        for( auto& k: readKernels(fileName) ) {
+            size_t l = 0;
+            while( l < levels.size() && streamBytes(levels[l], k.threads) < k.n * k.bytesPerParticle ) {
+                l++;
+            }
+            const double memoryRoof = k.intensity * bandwidths[l].at(k.threads);
+            const double computeRoof = peakAt(k.threads);
+            k.level = bandwidths[l].name;
+            k.roof = min(memoryRoof, computeRoof);
+            k.memoryBound = memoryRoof < computeRoof;
+            kernels.push_back(k);
+        }
+    }
+    if( !kernels.empty() ) {
+        cout << "\n" << left << setw(36) << "kernel" << right << setw(12) << "n" << setw(5) << "thr"
+             << setw(10) << "flop/B" << setw(10) << "GFLOP/s" << setw(7) << "level" << setw(10) << "roof"
+             << setw(9) << "%roof" << endl;
+        for( auto& k: kernels ) {
+            cout << left << setw(36) << k.name << right << setw(12) << k.n << setw(5) << k.threads
+                 << setw(10) << k.intensity << setw(10) << k.gflops << setw(7) << k.level << setw(10) << k.roof
+                 << setw(9) << 100 * k.gflops / k.roof << endl;
+        }
+    }
+
+    ofstream csv(output + ".csv");
+    csv << "kind,name,level,threads,n,bytes,intensity,gflops,gb_per_s,roof_gflops,fraction_of_roof,bound\n";
+    csv << scientific << setprecision(6);
+    for( auto& p: peaks ) {
+        for( unsigned t: threadCounts ) {
+            csv << "peak," << p.name << ",," << t << ",,,," << p.at(t) << ",,,,\n";
+        }
+    }
+    for( auto& row: bandwidthRows ) {
+        csv << row;
+    }
+    for( auto& k: kernels ) {
+        csv << "kernel," << k.name << "," << k.level << "," << k.threads << "," << k.n << ","
+            << k.n * k.bytesPerParticle << "," << k.intensity << "," << k.gflops << ","
+            << k.gflops / k.intensity << "," << k.roof << "," << k.gflops / k.roof << ","
+            << (k.memoryBound ? "memory" : "compute") << "\n";
+    }
+    writeSvg(output + ".svg", peaks, bandwidths, kernels);
+    cout << "\nWrote " << output << ".csv and " << output << ".svg" << endl;
+}
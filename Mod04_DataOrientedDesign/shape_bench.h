@@ -0,0 +1,76 @@
+#ifndef _shape_bench_h
+#define _shape_bench_h
+
+// The parts shared by the shape benchmarks of code_shapes_before/before and
+// code_shapes_after/after, so that both measure the same shapes in the same way
+// and their tables can be compared line by line.
+//
+// randomSpecs(n, sorted) draws n shapes, half squares and half circles, with
+// sizes uniform in [0.1, 2), always from the same seed; sorted groups them by
+// kind and keeps the order of the sizes within a kind. Kind is the enum of the
+// tree, which must have a Square and a Circle.
+//
+// measure(variant, order, n, f) runs f() `reps` times in a perf region and
+// prints a line of the table: the time per call and per shape, the counters per
+// shape and the value returned by f, area/perimeter, which all the variants
+// compute in double so that they print the same value.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "perf_counters.h"
+
+template<class Kind>
+struct Spec {
+  Kind kind;
+  float size;
+};
+
+template<class Kind>
+std::vector<Spec<Kind>> randomSpecs(size_t n, bool sorted) {
+  std::mt19937 gen(42);
+  std::bernoulli_distribution circle(0.5);
+  std::uniform_real_distribution<float> size(0.1, 2.0);
+  std::vector<Spec<Kind>> specs(n);
+  for (Spec<Kind>& s: specs) {
+    s.kind = circle(gen) ? Kind::Circle : Kind::Square;
+    s.size = size(gen);
+  }
+  if (sorted) {
+    std::stable_sort(specs.begin(), specs.end(), [](const Spec<Kind>& a, const Spec<Kind>& b) { return a.kind < b.kind; });
+  }
+  return specs;
+}
+
+const int reps = 5;
+
+template<class F>
+void measure(const std::string& variant, const std::string& order, size_t n, F f) {
+  const std::string name = variant + "/" + order + "/" + std::to_string(n);
+  double result {};
+  for (int r = 0; r < reps; r++) {
+    perf::Region region(name);
+    result = f();
+  }
+  auto& stats = perf::Registry::instance().stats(name);
+  auto v = stats.total();
+  const double shapes = double(n) * stats.calls;
+  auto perShape = [shapes](double x) {
+    std::ostringstream ss;
+    if (x < 0) ss << "n/a";
+    else ss << std::fixed << std::setprecision(3) << x / shapes;
+    return ss.str();
+  };
+  std::cout << std::left << std::setw(10) << variant << std::setw(9) << order << std::right << std::setw(11) << n
+            << std::setw(11) << std::fixed << std::setprecision(2) << stats.seconds * 1e3 / stats.calls
+            << std::setw(10) << std::setprecision(2) << stats.seconds * 1e9 / shapes
+            << std::setw(10) << perShape(v[perf::BranchMisses]) << std::setw(10) << perShape(v[perf::L1DMisses])
+            << std::setw(10) << perShape(v[perf::LLCMisses]) << std::setw(12) << std::setprecision(4) << result
+            << std::endl;
+}
+
+#endif //_shape_bench_h
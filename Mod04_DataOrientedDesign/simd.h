@@ -0,0 +1,142 @@
+#ifndef _simd_h
+#define _simd_h
+
+// A minimal wrapper over the float SIMD registers of the target.
+//
+// vfloat holds simdWidth floats: 16 with AVX-512 (-mavx512f), 8 with AVX2
+// (-mavx2 -mfma), and 8 in a portable fallback that the compiler may or may not
+// vectorise. Build with -march=native to get the widest registers available.
+// Loads and stores of whole registers (vload, vstore) require an address
+// aligned to simdWidth * 4 bytes; vloadu and vstoreu accept any address.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+#if defined(__AVX512F__)
+
+constexpr size_t simdWidth = 16;
+using vfloat = __m512;
+
+inline vfloat vload(const float* p) { return _mm512_load_ps(p); }
+inline vfloat vloadu(const float* p) { return _mm512_loadu_ps(p); }
+inline void vstore(float* p, vfloat v) { _mm512_store_ps(p, v); }
+inline void vstoreu(float* p, vfloat v) { _mm512_storeu_ps(p, v); }
+// Non-temporal store: bypasses the caches, for data that is not read back soon.
+inline void vstream(float* p, vfloat v) { _mm512_stream_ps(p, v); }
+// Orders the non-temporal stores before the stores that follow (a flag, the
+// end of a parallel step): call once after a loop of vstream.
+inline void vfence() { _mm_sfence(); }
+inline vfloat vset1(float x) { return _mm512_set1_ps(x); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm512_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm512_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm512_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm512_div_ps(a, b); }
+// min, max and the horizontal reductions use GCC vector extensions rather
+// than intrinsics, which trigger spurious -Wmaybe-uninitialized warnings in
+// GCC 12. The selects have the semantics of vminps/vmaxps (the second operand
+// is returned when the comparison fails).
+inline vfloat vmin(vfloat a, vfloat b) { return a < b ? a : b; }
+inline vfloat vmax(vfloat a, vfloat b) { return a > b ? a : b; }
+// a * b + c
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm512_fmadd_ps(a, b, c); }
+
+// Folds the register in halves down to one element.
+template<class Op>
+inline float reduce512(vfloat v, Op op) {
+  __m256 h8 = op(__builtin_shufflevector(v, v, 0, 1, 2, 3, 4, 5, 6, 7),
+                 __builtin_shufflevector(v, v, 8, 9, 10, 11, 12, 13, 14, 15));
+  __m128 h4 = op(__builtin_shufflevector(h8, h8, 0, 1, 2, 3), __builtin_shufflevector(h8, h8, 4, 5, 6, 7));
+  __m128 h2 = op(h4, __builtin_shufflevector(h4, h4, 2, 3, 2, 3));
+  __m128 h1 = op(h2, __builtin_shufflevector(h2, h2, 1, 1, 1, 1));
+  return h1[0];
+}
+inline float hsum(vfloat v) { return reduce512(v, [](auto a, auto b) { return a + b; }); }
+inline float hmin(vfloat v) { return reduce512(v, [](auto a, auto b) { return a < b ? a : b; }); }
+inline float hmax(vfloat v) { return reduce512(v, [](auto a, auto b) { return a > b ? a : b; }); }
+
+#elif defined(__AVX2__)
+
+constexpr size_t simdWidth = 8;
+using vfloat = __m256;
+
+inline vfloat vload(const float* p) { return _mm256_load_ps(p); }
+inline vfloat vloadu(const float* p) { return _mm256_loadu_ps(p); }
+inline void vstore(float* p, vfloat v) { _mm256_store_ps(p, v); }
+inline void vstoreu(float* p, vfloat v) { _mm256_storeu_ps(p, v); }
+inline void vstream(float* p, vfloat v) { _mm256_stream_ps(p, v); }
+inline void vfence() { _mm_sfence(); }
+inline vfloat vset1(float x) { return _mm256_set1_ps(x); }
+inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+#if defined(__FMA__)
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return vadd(vmul(a, b), c); }
+#endif
+
+inline float hsum(vfloat v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+inline float hmin(vfloat v) {
+  __m128 s = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_min_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_min_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+inline float hmax(vfloat v) {
+  __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_max_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+#else
+
+constexpr size_t simdWidth = 8;
+struct vfloat {
+  float v[simdWidth];
+};
+
+template<class Op>
+inline vfloat map2(vfloat a, vfloat b, Op op) {
+  vfloat r;
+  for (size_t k = 0; k < simdWidth; ++k) r.v[k] = op(a.v[k], b.v[k]);
+  return r;
+}
+
+inline vfloat vload(const float* p) { vfloat r; std::copy_n(p, simdWidth, r.v); return r; }
+inline vfloat vloadu(const float* p) { return vload(p); }
+inline void vstore(float* p, vfloat v) { std::copy_n(v.v, simdWidth, p); }
+inline void vstoreu(float* p, vfloat v) { vstore(p, v); }
+inline void vstream(float* p, vfloat v) { vstore(p, v); }
+inline void vfence() {}
+inline vfloat vset1(float x) { vfloat r; std::fill_n(r.v, simdWidth, x); return r; }
+inline vfloat vadd(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return x + y; }); }
+inline vfloat vsub(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return x - y; }); }
+inline vfloat vmul(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return x * y; }); }
+inline vfloat vdiv(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return x / y; }); }
+inline vfloat vmin(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline vfloat vmax(vfloat a, vfloat b) { return map2(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline vfloat vfmadd(vfloat a, vfloat b, vfloat c) { return vadd(vmul(a, b), c); }
+inline float hsum(vfloat v) { float s = 0; for (float x: v.v) s += x; return s; }
+inline float hmin(vfloat v) { return *std::min_element(v.v, v.v + simdWidth); }
+inline float hmax(vfloat v) { return *std::max_element(v.v, v.v + simdWidth); }
+
+#endif
+
+} // namespace simd
+
+#endif //_simd_h
@@ -0,0 +1,189 @@
+#ifndef _soa_vector_h
+#define _soa_vector_h
+
+// soa_vector<T, Layout>: a fixed-size container of aggregates whose memory
+// layout is chosen at compile time.
+//
+//   AoS          the elements are stored one after the other, as in vector<T>
+//   SoA          each scalar field has its own array
+//   AoSoA<B>     blocks of B elements, and within a block each field has its
+//                own array of B values (B a multiple of the SIMD width)
+//
+// The element type must be written as a class template over its scalar type,
+// all fields sharing this scalar type (possibly nested), for example
+//
+//   template<class F> struct BasicVec3 { F x; F y; F z; };
+//   template<class F> struct BasicParticle2 { BasicVec3<F> position; ...; F mass; };
+//   using Particle2 = BasicParticle2<float>;
+//
+// so that BasicParticle2<float&> is a proxy made of references to the
+// individual fields. v[i] returns such a proxy for SoA and AoSoA, and a plain
+// reference for AoS, so code like
+//
+//   auto&& p = v[i];
+//   p.velocity.x += p.accel.x * dt;
+//
+// compiles and runs unchanged for every layout. Use `auto&&` (or `auto` for
+// read-only access to a copy) to bind the result of v[i]. v.get(i) and
+// v.set(i, value) load and store whole elements.
+//
+// The fields are located by treating an element as an array of scalars, so T
+// must not contain padding (which a single scalar type guarantees in practice).
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+struct AoS {};
+struct SoA {};
+template<size_t B>
+struct AoSoA {
+  static constexpr size_t blockSize = B;
+};
+
+namespace soa_detail {
+
+// Recovers the template and the scalar type of an element type.
+template<class T>
+struct element_traits;
+
+template<template<class> class Tmpl, class S>
+struct element_traits<Tmpl<S>> {
+  using scalar = S;
+  using reference = Tmpl<S&>;
+  using const_reference = Tmpl<const S&>;
+};
+
+template<size_t Alignment = 64>
+struct AlignedBuffer {
+  void* ptr = nullptr;
+
+  explicit AlignedBuffer( size_t bytes )
+    : ptr(bytes ? ::operator new(bytes, std::align_val_t{Alignment}) : nullptr) {}
+  ~AlignedBuffer() {
+    if (ptr) ::operator delete(ptr, std::align_val_t{Alignment});
+  }
+  AlignedBuffer(AlignedBuffer&& o) noexcept : ptr(std::exchange(o.ptr, nullptr)) {}
+  AlignedBuffer& operator=(AlignedBuffer&& o) noexcept {
+    std::swap(ptr, o.ptr);
+    return *this;
+  }
+};
+
+} // namespace soa_detail
+
+template<class T, class Layout = SoA>
+class soa_vector {
+  using traits = soa_detail::element_traits<T>;
+
+public:
+  using value_type = T;
+  using scalar_type = typename traits::scalar;
+  static constexpr size_t numFields = sizeof(T) / sizeof(scalar_type);
+  static_assert(numFields * sizeof(scalar_type) == sizeof(T), "T must not contain padding");
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  using reference = std::conditional_t<std::is_same_v<Layout, AoS>, T&, typename traits::reference>;
+  using const_reference = std::conditional_t<std::is_same_v<Layout, AoS>, const T&, typename traits::const_reference>;
+
+  explicit soa_vector( size_t _n = 0 ): n(_n), buffer(storageSize(_n) * sizeof(scalar_type)) {
+    std::fill_n(data(), storageSize(n), scalar_type{});
+  }
+
+  // A vector of n uninitialised elements, to be filled with set(), e.g. by
+  // a parallel loop so that the pages are first touched by their users.
+  static soa_vector for_overwrite(size_t n) {
+    return soa_vector(n, Uninitialized{});
+  }
+
+  size_t size() const { return n; }
+
+  reference operator[](size_t i) {
+    if constexpr (std::is_same_v<Layout, AoS>) {
+      return static_cast<T*>(buffer.ptr)[i];
+    }
+    else {
+      return makeProxy<reference>(i, std::make_index_sequence<numFields>{});
+    }
+  }
+
+  const_reference operator[](size_t i) const {
+    if constexpr (std::is_same_v<Layout, AoS>) {
+      return static_cast<const T*>(buffer.ptr)[i];
+    }
+    else {
+      return makeProxy<const_reference>(i, std::make_index_sequence<numFields>{});
+    }
+  }
+
+  T get(size_t i) const {
+    std::array<scalar_type, numFields> fields;
+    for (size_t k = 0; k < numFields; ++k) {
+      fields[k] = field(k, i);
+    }
+    return std::bit_cast<T>(fields);
+  }
+
+  void set(size_t i, const T& value) {
+    auto fields = std::bit_cast<std::array<scalar_type, numFields>>(value);
+    for (size_t k = 0; k < numFields; ++k) {
+      field(k, i) = fields[k];
+    }
+  }
+
+  // Field k (in declaration order, nested aggregates flattened) of element i.
+  scalar_type& field(size_t k, size_t i) { return data()[offset(k, i)]; }
+  const scalar_type& field(size_t k, size_t i) const { return data()[offset(k, i)]; }
+
+  // Start of the array of field k. Only for SoA, where it holds size() values.
+  scalar_type* column(size_t k) requires std::is_same_v<Layout, SoA> { return data() + k * n; }
+  const scalar_type* column(size_t k) const requires std::is_same_v<Layout, SoA> { return data() + k * n; }
+
+  scalar_type* data() { return static_cast<scalar_type*>(buffer.ptr); }
+  const scalar_type* data() const { return static_cast<const scalar_type*>(buffer.ptr); }
+
+private:
+  struct Uninitialized {};
+  soa_vector( size_t _n, Uninitialized ): n(_n), buffer(storageSize(_n) * sizeof(scalar_type)) {}
+
+  // AoSoA rounds the size up to a whole number of blocks.
+  static size_t storageSize(size_t n) {
+    if constexpr (std::is_same_v<Layout, AoS> || std::is_same_v<Layout, SoA>) {
+      return n * numFields;
+    }
+    else {
+      constexpr size_t B = Layout::blockSize;
+      return (n + B - 1) / B * B * numFields;
+    }
+  }
+
+  size_t offset(size_t k, size_t i) const {
+    if constexpr (std::is_same_v<Layout, AoS>) {
+      return i * numFields + k;
+    }
+    else if constexpr (std::is_same_v<Layout, SoA>) {
+      return k * n + i;
+    }
+    else {
+      constexpr size_t B = Layout::blockSize;
+      return (i / B) * B * numFields + k * B + i % B;
+    }
+  }
+
+  // Brace elision lets the flat list of field references initialise the
+  // nested aggregates of the proxy.
+  template<class Proxy, size_t... K>
+  Proxy makeProxy(size_t i, std::index_sequence<K...>) const {
+    auto* d = const_cast<scalar_type*>(data());
+    return Proxy{ d[offset(K, i)]... };
+  }
+
+  size_t n;
+  soa_detail::AlignedBuffer<> buffer;
+};
+
+#endif //_soa_vector_h
@@ -0,0 +1,234 @@
+#ifndef _trace_h
+#define _trace_h
+
+// Low-overhead phase timing.
+//
+// Compile with -DTRACE to enable. Without it, the TRACE_SCOPE and TRACE_REPORT
+// macros expand to nothing and no code is generated.
+//
+//   TRACE_SCOPE("computeGrid");     // times the enclosing block
+//   TRACE_REPORT("trace.json");     // prints per-phase statistics and writes
+//                                   // a Chrome-trace / Perfetto timeline
+//
+// A scope reads the time-stamp counter when it is entered and when it is left,
+// and appends one event to a fixed-size ring buffer owned by the current
+// thread: no lock, no allocation, no system call. When the ring is full the
+// oldest events are overwritten, but the per-phase statistics (count, total,
+// min, max, and a log2 histogram of the durations) are updated for every event
+// and are therefore always complete.
+//
+// Phase names must be string literals: only the pointer is stored.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace trace {
+
+// Reads the cheapest available monotonic clock, in ticks.
+inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+struct Event {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Duration statistics of one phase, in ticks.
+struct PhaseStats {
+  const char* name = nullptr;
+  uint64_t count = 0;
+  uint64_t total = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+  std::array<uint64_t, 64> histogram{};  // bucket b counts durations in [2^b, 2^(b+1))
+
+  void add(uint64_t d) {
+    ++count;
+    total += d;
+    min = std::min(min, d);
+    max = std::max(max, d);
+    ++histogram[d == 0 ? 0 : 63 - __builtin_clzll(d)];
+  }
+
+  void merge(const PhaseStats& o) {
+    count += o.count;
+    total += o.total;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+    for (size_t b = 0; b < histogram.size(); ++b) {
+      histogram[b] += o.histogram[b];
+    }
+  }
+};
+
+struct ThreadBuffer {
+  static constexpr size_t capacity = 1 << 16;
+  size_t tid;
+  std::vector<Event> ring = std::vector<Event>(capacity);
+  uint64_t written = 0;
+  // A simulation has a handful of phases, a linear search is the fastest lookup.
+  std::vector<PhaseStats> phases;
+
+  void record(const char* name, uint64_t t0, uint64_t t1) {
+    ring[written++ % capacity] = Event{ name, t0, t1 };
+    auto it = std::find_if(phases.begin(), phases.end(), [name](auto& p) { return p.name == name; });
+    if (it == phases.end()) {
+      phases.push_back(PhaseStats{ .name = name });
+      it = phases.end() - 1;
+    }
+    it->add(t1 - t0);
+  }
+};
+
+// Owns the buffers of all threads, so that they outlive the threads.
+class Registry {
+public:
+  static Registry& instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  ThreadBuffer& local() {
+    thread_local ThreadBuffer* buffer = [this] {
+      std::lock_guard lock(mutex);
+      buffers.push_back(std::make_unique<ThreadBuffer>());
+      buffers.back()->tid = buffers.size() - 1;
+      return buffers.back().get();
+    }();
+    return *buffer;
+  }
+
+  // Converts ticks to nanoseconds, calibrated against steady_clock over the
+  // lifetime of the registry.
+  double nsPerTick() const {
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+    return ns / (double)std::max<uint64_t>(1, ticks() - startTicks);
+  }
+
+  void report(std::ostream& os, const std::string& jsonFile) {
+    std::lock_guard lock(mutex);
+    const double scale = nsPerTick();
+
+    // Merge the per-thread statistics, keeping the order of first appearance.
+    std::vector<PhaseStats> phases;
+    for (auto& b: buffers) {
+      for (auto& p: b->phases) {
+        auto it = std::find_if(phases.begin(), phases.end(), [&p](auto& q) { return q.name == p.name; });
+        if (it == phases.end()) {
+          phases.push_back(p);
+        }
+        else {
+          it->merge(p);
+        }
+      }
+    }
+    uint64_t grandTotal = 0;
+    for (auto& p: phases) {
+      grandTotal += p.total;
+    }
+
+    os << std::left << std::setw(20) << "phase" << std::right
+       << std::setw(10) << "count" << std::setw(12) << "total[ms]" << std::setw(8) << "share"
+       << std::setw(12) << "mean[us]" << std::setw(12) << "min[us]" << std::setw(12) << "max[us]" << "\n";
+    for (auto& p: phases) {
+      os << std::left << std::setw(20) << p.name << std::right << std::fixed << std::setprecision(2)
+         << std::setw(10) << p.count
+         << std::setw(12) << p.total * scale * 1e-6
+         << std::setw(7) << 100. * p.total / std::max<uint64_t>(1, grandTotal) << "%"
+         << std::setw(12) << p.total * scale * 1e-3 / p.count
+         << std::setw(12) << p.min * scale * 1e-3
+         << std::setw(12) << p.max * scale * 1e-3 << "\n";
+    }
+    os << "\nDuration histograms (bucket lower bound in us: count)\n";
+    for (auto& p: phases) {
+      os << std::left << std::setw(20) << p.name << std::right;
+      for (size_t b = 0; b < p.histogram.size(); ++b) {
+        if (p.histogram[b] > 0) {
+          os << "  " << std::setprecision(1) << (double)(1ull << b) * scale * 1e-3 << ": " << p.histogram[b];
+        }
+      }
+      os << "\n";
+    }
+    os << std::defaultfloat;
+
+    if (!jsonFile.empty()) {
+      writeChromeTrace(jsonFile, scale);
+      os << "\nTimeline written to " << jsonFile << " (open in chrome://tracing or ui.perfetto.dev)\n";
+    }
+  }
+
+private:
+  Registry(): startTime(std::chrono::steady_clock::now()), startTicks(ticks()) {}
+
+  // Writes the events still present in the ring buffers as complete ("X")
+  // events of the Chrome trace-event format, with timestamps in microseconds.
+  void writeChromeTrace(const std::string& fname, double scale) {
+    std::ofstream ofile(fname);
+    ofile << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (auto& b: buffers) {
+      uint64_t n = std::min<uint64_t>(b->written, ThreadBuffer::capacity);
+      for (uint64_t k = b->written - n; k < b->written; ++k) {
+        const Event& e = b->ring[k % ThreadBuffer::capacity];
+        ofile << (first ? "" : ",\n") << std::fixed << std::setprecision(3)
+              << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << b->tid
+              << ",\"ts\":" << (double)(e.begin - startTicks) * scale * 1e-3
+              << ",\"dur\":" << (double)(e.end - e.begin) * scale * 1e-3 << "}";
+        first = false;
+      }
+    }
+    ofile << "\n]}\n";
+  }
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::chrono::steady_clock::time_point startTime;
+  uint64_t startTicks;
+};
+
+class Scope {
+public:
+  explicit Scope( const char* _name ): name(_name), buffer(Registry::instance().local()), begin(ticks()) {}
+  ~Scope() { buffer.record(name, begin, ticks()); }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+private:
+  const char* name;
+  ThreadBuffer& buffer;
+  uint64_t begin;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TRACE
+#define TRACE_SCOPE(name) ::trace::Scope TRACE_CONCAT(traceScope_, __LINE__){name}
+#define TRACE_REPORT(jsonFile) ::trace::Registry::instance().report(std::cout, jsonFile)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_REPORT(jsonFile)
+#endif
+
+#endif //_trace_h
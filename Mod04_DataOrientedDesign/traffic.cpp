@@ -0,0 +1,425 @@
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include "parallel.h"
+#include "philox.h"
+#include "perf_counters.h"
+
+using namespace std;
+
+// The data-oriented traffic simulation of 04_FromOOtoDO.md, made to scale.
+//
+// In the notes, Vehicle::update receives the whole vector<Vehicle> and
+// vector<Pedestrian>: every agent looks at every other one, O(n^2) per step,
+// and every vehicle goes through a switch on its kind. Here
+//
+//  - the agents are stored as columns (Agents), one set of columns per
+//    VehicleKind and one for the pedestrians. The kind of a vehicle is the
+//    partition it is in, and the physics of a kind (VehicleParams) is stored
+//    once, not in every vehicle. Each partition is updated by its own loop.
+//  - neighbours are found with a uniform grid, as in particle.cpp: the agents
+//    are sorted by grid cell, and the index of the first agent of each cell is
+//    recorded. Cells are as large as the largest interaction range, so an agent
+//    only looks at the 3x3 cells around its own: O(n) per step. Vehicles and
+//    pedestrians have a grid each, since pedestrians only react to vehicles.
+//  - every reorderInterval steps, the columns of each partition are sorted by
+//    cell, as particle.cpp sorts its particles. Agents that are updated one
+//    after the other are then near each other and scan the same cells, which
+//    are in the cache; in random order each scan misses the cache (and a step
+//    on 1e6 agents took twice as long).
+//
+// Usage: traffic [agents] [steps] [threads]
+//
+// Example: g++ -std=c++20 -O3 -march=native -pthread -o traffic traffic.cpp
+
+// Parameters in metres and seconds.
+constexpr float dt = 0.1f;               // Discrete time step
+constexpr float areaPerAgent = 100.f;    // The domain grows with the number of agents
+constexpr float vehicleFraction = 0.4f;  // The rest are pedestrians
+constexpr float cellSize = 10.f;         // Side of a grid cell: the largest interaction range
+constexpr float laneHalfWidth = 1.5f;    // An agent further aside is not in a vehicle's way
+constexpr float creepSpeed = 0.5f;       // A blocked vehicle edges to the right at this speed
+constexpr float arrivalRadius = 2.f;     // An agent that reaches its target picks a new one
+constexpr float pedestrianSpeed = 1.4f;
+constexpr float avoidanceRange = 5.f;    // Pedestrians step away from closer vehicles
+constexpr float avoidanceStrength = 2.f;
+constexpr int reorderInterval = 16;      // Steps between two sorts of the agent columns by cell
+
+enum class VehicleKind { CAR, BUS, TAXI };
+constexpr size_t numVehicleKinds = 3;
+
+// The physics of a kind of vehicle.
+struct VehicleParams {
+    float share;           // Fraction of the vehicles of this kind
+    float spaceOccupied;   // The vehicle stops behind an agent closer than this
+    float lookAhead;       // and brakes behind an agent closer than this
+    float maxSpeed;
+    float acceleration;
+    float deceleration;
+};
+
+constexpr array<VehicleParams, numVehicleKinds> vehicleParams {{
+    { 0.7f,  4.5f, 8.f,  14.f, 3.0f, 6.f },   // CAR
+    { 0.1f,  7.0f, 10.f, 11.f, 1.2f, 4.f },   // BUS
+    { 0.2f,  4.5f, 6.f,  15.f, 3.5f, 7.f },   // TAXI
+}};
+
+static_assert(ranges::all_of(vehicleParams, [](const VehicleParams& p) {
+    return p.spaceOccupied < p.lookAhead && p.lookAhead <= cellSize;
+}));
+static_assert(avoidanceRange <= cellSize);
+
+// The agents of one partition, one column per field.
+struct Agents {
+    vector<float> x, y;
+    vector<float> targetX, targetY;
+    vector<float> speed;
+    vector<float> attention;
+    vector<float> recklessness;
+
+    size_t size() const { return x.size(); }
+
+    void resize(size_t n) {
+        for (auto column : { &x, &y, &targetX, &targetY, &speed, &attention, &recklessness }) {
+            column->resize(n);
+        }
+    }
+};
+
+// The cell list of some partitions. Their agents are numbered one partition
+// after the other. Positions are copied in cell order, so that the agent
+// columns keep their order and a neighbour scan reads contiguous memory.
+struct Grid {
+    size_t side;                // Cells per side
+    vector<uint32_t> cellStart; // The agents of cell c are [cellStart[c], cellStart[c+1])
+    vector<float> x, y;         // Positions, in cell order
+    vector<uint32_t> id;        // Numbers, in cell order
+    vector<uint32_t> cell;      // The cell of each agent, by number
+    vector<uint32_t> offsets;   // Per-thread counts, then insertion points: [t * cells + c]
+
+    size_t cells() const { return side * side; }
+
+    size_t coordinate(float p) const {
+        return min(side - 1, size_t(max(p, 0.f) * (1.f / cellSize)));
+    }
+
+    size_t cellOf(float px, float py) const {
+        return coordinate(py) + side * coordinate(px);
+    }
+
+    // Calls f(begin, end) for the slots [begin, end) of the agents in the 3x3
+    // cells around (px, py), one row of three cells at a time.
+    template<class F>
+    void forNeighbours(float px, float py, F f) const {
+        const size_t cx = coordinate(px), cy = coordinate(py);
+        for (size_t nx = cx > 0 ? cx - 1 : 0; nx <= min(cx + 1, side - 1); ++nx) {
+            // The cells (nx, cy-1 .. cy+1) are consecutive.
+            size_t low = nx * side + (cy > 0 ? cy - 1 : 0);
+            size_t high = nx * side + min(cy + 1, side - 1);
+            f(cellStart[low], cellStart[high + 1]);
+        }
+    }
+};
+
+using Partitions = vector<Agents*>;
+
+// Calls f(agents, i, g) for the agents numbered [first, last) of the
+// partitions, where i is the index of agent g in its partition.
+template<class F>
+void forAgents(const Partitions& parts, size_t first, size_t last, F f) {
+    size_t offset = 0;
+    for (Agents* a : parts) {
+        size_t begin = max(first, offset), end = min(last, offset + a->size());
+        for (size_t g = begin; g < end; ++g) {
+            f(*a, g - offset, g);
+        }
+        offset += a->size();
+    }
+}
+
+size_t sizeOf(const Partitions& parts) {
+    size_t n = 0;
+    for (const Agents* a : parts) n += a->size();
+    return n;
+}
+
+// A parallel counting sort of the agents by cell: each thread counts the agents
+// of its chunk per cell, the counts give every thread its insertion points,
+// and each thread copies its chunk. The order within a cell is the order of
+// the numbers, whatever the number of threads.
+void computeGrid(Grid& grid, const Partitions& parts) {
+    const size_t n = sizeOf(parts), cells = grid.cells();
+    const unsigned threads = numThreads();
+    grid.x.resize(n);
+    grid.y.resize(n);
+    grid.id.resize(n);
+    grid.cell.resize(n);
+    grid.offsets.assign(threads * cells, 0);
+    parallelFor(n, [&grid, &parts, cells](size_t first, size_t last, unsigned t) {
+        uint32_t* count = &grid.offsets[t * cells];
+        forAgents(parts, first, last, [&](Agents& a, size_t i, size_t g) {
+            uint32_t c = grid.cellOf(a.x[i], a.y[i]);
+            grid.cell[g] = c;
+            ++count[c];
+        });
+    });
+    uint32_t start = 0;
+    for (size_t c = 0; c < cells; ++c) {
+        grid.cellStart[c] = start;
+        for (unsigned t = 0; t < threads; ++t) {
+            uint32_t count = grid.offsets[t * cells + c];
+            grid.offsets[t * cells + c] = start;
+            start += count;
+        }
+    }
+    grid.cellStart[cells] = start;
+    parallelFor(n, [&grid, &parts, cells](size_t first, size_t last, unsigned t) {
+        uint32_t* next = &grid.offsets[t * cells];
+        forAgents(parts, first, last, [&](Agents& a, size_t i, size_t g) {
+            uint32_t s = next[grid.cell[g]]++;
+            grid.x[s] = a.x[i];
+            grid.y[s] = a.y[i];
+            grid.id[s] = g;
+        });
+    });
+}
+
+// Sorts the columns of every partition in the order of the grid, so that the
+// agents of a partition are sorted by cell.
+void reorderAgents(const Grid& grid, const Partitions& parts) {
+    size_t offset = 0;
+    vector<uint32_t> order;
+    for (Agents* a : parts) {
+        order.clear();
+        for (uint32_t g : grid.id) {
+            if (g >= offset && g < offset + a->size()) order.push_back(g - offset);
+        }
+        vector<float> sorted(a->size());
+        for (auto column : { &a->x, &a->y, &a->targetX, &a->targetY, &a->speed, &a->attention, &a->recklessness }) {
+            parallelFor(a->size(), [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    sorted[i] = (*column)[order[i]];
+                }
+            });
+            column->swap(sorted);
+        }
+        offset += a->size();
+    }
+}
+
+class TrafficSimulationDOD {
+public:
+    TrafficSimulationDOD(size_t numAgents, uint64_t seed)
+        : side(sqrt(numAgents * areaPerAgent)), rng(seed) {
+        const size_t numVehicles = numAgents * vehicleFraction;
+        size_t assigned = 0;
+        for (size_t k = 0; k < numVehicleKinds; ++k) {
+            size_t n = k + 1 < numVehicleKinds ? size_t(numVehicles * vehicleParams[k].share) : numVehicles - assigned;
+            vehicles[k].resize(n);
+            assigned += n;
+        }
+        pedestrians.resize(numAgents - numVehicles);
+
+        // Everything is drawn from the counter-based generator, by the number of
+        // the agent among all agents.
+        forAgents(allParts(), 0, numAgents, [this](Agents& a, size_t i, size_t g) {
+            auto p = rng.uniform4(g, 0, 0.f, side);
+            auto s = rng.uniform4(g, 1, 0.f, 1.f);
+            a.x[i] = p[0];
+            a.y[i] = p[1];
+            a.targetX[i] = p[2];
+            a.targetY[i] = p[3];
+            a.speed[i] = 0.f;
+            a.attention[i] = s[0];
+            a.recklessness[i] = s[1];
+        });
+
+        for (Grid* grid : { &vehicleGrid, &pedestrianGrid }) {
+            grid->side = max<size_t>(1, size_t(side / cellSize));
+            grid->cellStart.resize(grid->cells() + 1);
+        }
+    }
+
+    size_t size() const { return numVehicles() + pedestrians.size(); }
+
+    size_t numVehicles() const {
+        size_t n = 0;
+        for (auto& v : vehicles) n += v.size();
+        return n;
+    }
+
+    void simulateStep() {
+        if (step % reorderInterval == 0) {
+            PERF_REGION("reorderAgents");
+            computeGrid(vehicleGrid, vehicleParts());
+            reorderAgents(vehicleGrid, vehicleParts());
+            computeGrid(pedestrianGrid, { &pedestrians });
+            reorderAgents(pedestrianGrid, { &pedestrians });
+        }
+        {
+            PERF_REGION("computeGrid");
+            computeGrid(vehicleGrid, vehicleParts());
+            computeGrid(pedestrianGrid, { &pedestrians });
+        }
+        {
+            PERF_REGION("updateVehicles");
+            size_t first = 0;
+            for (size_t k = 0; k < numVehicleKinds; ++k) {
+                updateVehicles(vehicles[k], vehicleParams[k], first);
+                first += vehicles[k].size();
+            }
+        }
+        {
+            PERF_REGION("updatePedestrians");
+            updatePedestrians(numVehicles());
+        }
+        ++step;
+    }
+
+    // The mean speed of the vehicles of a kind.
+    float meanSpeed(VehicleKind kind) const {
+        const auto& speed = vehicles[size_t(kind)].speed;
+        double sum = 0;
+        for (float s : speed) sum += s;
+        return speed.empty() ? 0.f : float(sum / speed.size());
+    }
+
+private:
+    Partitions vehicleParts() { return { &vehicles[0], &vehicles[1], &vehicles[2] }; }
+    Partitions allParts() { return { &vehicles[0], &vehicles[1], &vehicles[2], &pedestrians }; }
+
+    // Agents that reach their target draw a new one; the draw depends on the
+    // agent and the step only.
+    void retarget(Agents& a, size_t i, size_t g, float remaining) {
+        if (remaining < arrivalRadius) {
+            auto p = rng.uniform4(g, 2 + step, 0.f, side);
+            a.targetX[i] = p[0];
+            a.targetY[i] = p[1];
+        }
+    }
+
+    // Vehicles drive straight to their target. A vehicle accelerates up to the
+    // top speed of its kind, brakes when an agent is in its lane within
+    // lookAhead, and when one is closer than spaceOccupied it stops and edges
+    // to the right to get round it. Inattentive drivers are slower, reckless
+    // ones faster. firstId is the number of the first vehicle of the partition.
+    void updateVehicles(Agents& v, const VehicleParams& p, size_t firstId) {
+        parallelFor(v.size(), [&, firstId](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                const float x = v.x[i], y = v.y[i];
+                const float dx = v.targetX[i] - x, dy = v.targetY[i] - y;
+                const float dist = max(sqrt(dx*dx + dy*dy), 1e-6f);
+                float dirX = dx / dist, dirY = dy / dist;
+
+                // The vehicle itself is not ahead of itself (along == 0).
+                float gap = p.lookAhead;
+                auto ahead = [&gap, x, y, dirX, dirY](const Grid& grid) {
+                    grid.forNeighbours(x, y, [&](uint32_t begin, uint32_t end) {
+                        // A local minimum: with gap itself the compiler kept it in memory.
+                        float g = gap;
+                        for (uint32_t s = begin; s < end; ++s) {
+                            float rx = grid.x[s] - x, ry = grid.y[s] - y;
+                            float along = rx*dirX + ry*dirY, aside = fabs(rx*dirY - ry*dirX);
+                            bool inLane = (along > 0.f) & (aside < laneHalfWidth);
+                            g = inLane ? min(g, along) : g;
+                        }
+                        gap = g;
+                    });
+                };
+                ahead(vehicleGrid);
+                ahead(pedestrianGrid);
+
+                const float factor = (v.attention[i] < 0.5f ? 0.8f : 1.f) * (v.recklessness[i] > 0.7f ? 1.2f : 1.f);
+                float speed = gap < p.lookAhead ? max(0.f, v.speed[i] - p.deceleration*dt)
+                                                : min(p.maxSpeed, v.speed[i] + p.acceleration*dt);
+                if (gap < p.spaceOccupied) {
+                    // Turn right by 45 degrees.
+                    constexpr float c = 0.70710678f;
+                    float turnedX = c*(dirX + dirY), turnedY = c*(dirY - dirX);
+                    dirX = turnedX;
+                    dirY = turnedY;
+                    speed = creepSpeed;
+                }
+                v.speed[i] = speed;
+                const float move = min(speed * factor * dt, dist);
+                v.x[i] = clamp(x + dirX*move, 0.f, side);
+                v.y[i] = clamp(y + dirY*move, 0.f, side);
+                retarget(v, i, firstId + i, dist - move);
+            }
+        });
+    }
+
+    // Pedestrians walk to their target and step away from the vehicles
+    // within avoidanceRange. Inattentive pedestrians are slower.
+    void updatePedestrians(size_t firstId) {
+        Agents& a = pedestrians;
+        const Grid& grid = vehicleGrid;
+        parallelFor(a.size(), [&, firstId](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                const float x = a.x[i], y = a.y[i];
+                const float dx = a.targetX[i] - x, dy = a.targetY[i] - y;
+                const float dist = max(sqrt(dx*dx + dy*dy), 1e-6f);
+                const float walk = pedestrianSpeed * (a.attention[i] < 0.3f ? 0.5f : 1.f);
+                float vx = walk * dx / dist, vy = walk * dy / dist;
+
+                grid.forNeighbours(x, y, [&](uint32_t begin, uint32_t end) {
+                    float px = 0.f, py = 0.f;
+                    for (uint32_t s = begin; s < end; ++s) {
+                        float rx = x - grid.x[s], ry = y - grid.y[s];
+                        float d2 = max(rx*rx + ry*ry, 1e-2f);
+                        float push = d2 < avoidanceRange*avoidanceRange ? avoidanceStrength / d2 : 0.f;
+                        px += push * rx;
+                        py += push * ry;
+                    }
+                    vx += px;
+                    vy += py;
+                });
+
+                a.speed[i] = sqrt(vx*vx + vy*vy);
+                a.x[i] = clamp(x + vx*dt, 0.f, side);
+                a.y[i] = clamp(y + vy*dt, 0.f, side);
+                float rx = a.targetX[i] - a.x[i], ry = a.targetY[i] - a.y[i];
+                retarget(a, i, firstId + i, sqrt(rx*rx + ry*ry));
+            }
+        });
+    }
+
+    float side;
+    Philox4x32 rng;
+    size_t step = 0;
+    array<Agents, numVehicleKinds> vehicles;
+    Agents pedestrians;
+    Grid vehicleGrid;
+    Grid pedestrianGrid;
+};
+
+int main(int argc, char** argv) {
+    const size_t numAgents = argc > 1 ? size_t(stod(argv[1])) : 1'000'000;
+    const int numSteps = argc > 2 ? stoi(argv[2]) : 100;
+    if (argc > 3) {
+        setNumThreads(stoi(argv[3]));
+    }
+
+    auto sim = TrafficSimulationDOD(numAgents, 1);
+    auto start_time = chrono::steady_clock::now();
+    for (int t = 0; t < numSteps; ++t) {
+        sim.simulateStep();
+    }
+    auto end_time = chrono::steady_clock::now();
+    auto seconds = chrono::duration<double>(end_time - start_time).count();
+
+    cout << sim.size() << " agents (" << sim.numVehicles() << " vehicles), " << numSteps << " steps, "
+         << numThreads() << " threads" << endl;
+    // Real time is one step of dt simulated seconds per dt seconds.
+    cout << "Time per step: " << setprecision(3) << seconds / numSteps * 1e3 << " ms, "
+         << numSteps * dt / seconds << "x real time" << endl;
+    cout << "Mean speed: car " << sim.meanSpeed(VehicleKind::CAR) << ", bus " << sim.meanSpeed(VehicleKind::BUS)
+         << ", taxi " << sim.meanSpeed(VehicleKind::TAXI) << " m/s" << endl;
+    PERF_REPORT();
+}
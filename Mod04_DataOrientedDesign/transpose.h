@@ -0,0 +1,312 @@
+#ifndef _transpose_h
+#define _transpose_h
+
+// Transposition between records and rows in SIMD registers, for converting
+// between AoS and SoA layouts.
+//
+// A block is simdWidth consecutive records of `stride` floats (for instance
+// simdWidth Particle2, stride 10). loadRecords() turns a block into `stride`
+// registers, register f holding field f of the simdWidth records: this is the
+// block as simdWidth values of each field, i.e. the SoA (or AoSoA) form.
+// storeRecords() does the reverse.
+//
+// Both work on simdWidth x simdWidth tiles: simdWidth records (or the part
+// [g * simdWidth, (g + 1) * simdWidth) of each record, when stride >
+// simdWidth) are loaded into simdWidth registers and transposed in registers
+// with unpack and shuffle instructions: 64 shuffles for 16 x 16 with AVX-512,
+// 24 for 8 x 8 with AVX2. The rows of a tile overlap when stride is not a
+// multiple of simdWidth; the last ones are loaded and stored with masks, so
+// that a block never touches its neighbours (another thread may be converting
+// them). Short records (3 floats for a Vec3) use permutations instead, see
+// transpose_detail::permutes.
+//
+// recordsToRows() and rowsToRecords() convert a block in place: a block of
+// records has exactly the size of the same block in AoSoA form.
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "simd.h"
+
+namespace simd {
+
+#if defined(__AVX512F__)
+
+// Zero-masked forms with a full mask: they run at the same speed, and the
+// plain intrinsics pass _mm512_undefined_ps() through, which GCC 12 reports as
+// uninitialised once inlined.
+inline void transpose(vfloat (&r)[simdWidth]) {
+  constexpr __mmask16 all = 0xFFFF;
+  vfloat t[simdWidth];
+  // Within each 128-bit lane: pairs of rows, then groups of 4 rows.
+  for (size_t i = 0; i < simdWidth; i += 2) {
+    t[i] = _mm512_maskz_unpacklo_ps(all, r[i], r[i + 1]);
+    t[i + 1] = _mm512_maskz_unpackhi_ps(all, r[i], r[i + 1]);
+  }
+  for (size_t i = 0; i < simdWidth; i += 4) {
+    r[i] = _mm512_maskz_shuffle_ps(all, t[i], t[i + 2], 0x44);
+    r[i + 1] = _mm512_maskz_shuffle_ps(all, t[i], t[i + 2], 0xEE);
+    r[i + 2] = _mm512_maskz_shuffle_ps(all, t[i + 1], t[i + 3], 0x44);
+    r[i + 3] = _mm512_maskz_shuffle_ps(all, t[i + 1], t[i + 3], 0xEE);
+  }
+  // r[4i + j] now holds, in lane L, column 4L + j of rows 4i..4i+3: transpose
+  // the 4 x 4 lanes of r[j], r[4 + j], r[8 + j], r[12 + j].
+  for (size_t j = 0; j < 4; ++j) {
+    t[j] = _mm512_maskz_shuffle_f32x4(all, r[j], r[4 + j], 0x88);
+    t[4 + j] = _mm512_maskz_shuffle_f32x4(all, r[j], r[4 + j], 0xDD);
+    t[8 + j] = _mm512_maskz_shuffle_f32x4(all, r[8 + j], r[12 + j], 0x88);
+    t[12 + j] = _mm512_maskz_shuffle_f32x4(all, r[8 + j], r[12 + j], 0xDD);
+  }
+  for (size_t j = 0; j < 4; ++j) {
+    r[j] = _mm512_maskz_shuffle_f32x4(all, t[j], t[8 + j], 0x88);
+    r[8 + j] = _mm512_maskz_shuffle_f32x4(all, t[j], t[8 + j], 0xDD);
+    r[4 + j] = _mm512_maskz_shuffle_f32x4(all, t[4 + j], t[12 + j], 0x88);
+    r[12 + j] = _mm512_maskz_shuffle_f32x4(all, t[4 + j], t[12 + j], 0xDD);
+  }
+}
+
+inline vfloat vzero() { return _mm512_setzero_ps(); }
+inline vfloat vpermute(vfloat v, const int32_t* index) {
+  return _mm512_maskz_permutexvar_ps(0xFFFF, _mm512_loadu_si512(index), v);
+}
+inline vfloat vselect(uint32_t mask, vfloat a, vfloat b) { return _mm512_mask_blend_ps(__mmask16(mask), a, b); }
+// The first `count` floats at p (the other lanes are zero), and the reverse.
+inline vfloat vloadn(const float* p, size_t count) { return _mm512_maskz_loadu_ps(__mmask16((1u << count) - 1), p); }
+inline void vstoren(float* p, vfloat v, size_t count) { _mm512_mask_storeu_ps(p, __mmask16((1u << count) - 1), v); }
+
+#elif defined(__AVX2__)
+
+inline void transpose(vfloat (&r)[simdWidth]) {
+  vfloat t[simdWidth], s[simdWidth];
+  for (size_t i = 0; i < simdWidth; i += 2) {
+    t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+  }
+  for (size_t i = 0; i < simdWidth; i += 4) {
+    s[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+    s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xEE);
+    s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+    s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xEE);
+  }
+  for (size_t j = 0; j < 4; ++j) {
+    r[j] = _mm256_permute2f128_ps(s[j], s[4 + j], 0x20);
+    r[4 + j] = _mm256_permute2f128_ps(s[j], s[4 + j], 0x31);
+  }
+}
+
+inline vfloat vzero() { return _mm256_setzero_ps(); }
+inline vfloat vpermute(vfloat v, const int32_t* index) {
+  return _mm256_permutevar8x32_ps(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index)));
+}
+inline vfloat vselect(uint32_t mask, vfloat a, vfloat b) {
+  const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(mask)), bits), bits);
+  return _mm256_blendv_ps(a, b, _mm256_castsi256_ps(m));
+}
+inline __m256i firstLanes(size_t count) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(int(count)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+inline vfloat vloadn(const float* p, size_t count) { return _mm256_maskload_ps(p, firstLanes(count)); }
+inline void vstoren(float* p, vfloat v, size_t count) { _mm256_maskstore_ps(p, firstLanes(count), v); }
+
+#else
+
+inline void transpose(vfloat (&r)[simdWidth]) {
+  for (size_t i = 0; i < simdWidth; ++i) {
+    for (size_t j = i + 1; j < simdWidth; ++j) std::swap(r[i].v[j], r[j].v[i]);
+  }
+}
+
+inline vfloat vzero() { return vset1(0.f); }
+inline vfloat vpermute(vfloat v, const int32_t* index) {
+  vfloat r;
+  for (size_t l = 0; l < simdWidth; ++l) r.v[l] = v.v[index[l]];
+  return r;
+}
+inline vfloat vselect(uint32_t mask, vfloat a, vfloat b) {
+  for (size_t l = 0; l < simdWidth; ++l) if (mask >> l & 1) a.v[l] = b.v[l];
+  return a;
+}
+inline vfloat vloadn(const float* p, size_t count) {
+  vfloat r = vzero();
+  std::copy_n(p, count, r.v);
+  return r;
+}
+inline void vstoren(float* p, vfloat v, size_t count) { std::copy_n(v.v, count, p); }
+
+#endif
+
+namespace transpose_detail {
+
+// Number of tiles per record.
+template<size_t stride>
+constexpr size_t groups = (stride + simdWidth - 1) / simdWidth;
+
+// Row k of tile g is the part [g * simdWidth, (g + 1) * simdWidth) of record
+// k, cut at the end of the block.
+template<size_t stride>
+constexpr size_t rowLength(size_t k, size_t g) {
+  return std::min(simdWidth, simdWidth * stride - (k * stride + g * simdWidth));
+}
+
+template<size_t stride>
+inline void fromTiles(const float* p, vfloat (&fields)[stride]) {
+  for (size_t g = 0; g < groups<stride>; ++g) {
+    vfloat r[simdWidth];
+    for (size_t k = 0; k < simdWidth; ++k) {
+      const float* row = p + k * stride + g * simdWidth;
+      const size_t length = rowLength<stride>(k, g);
+      r[k] = length == simdWidth ? vloadu(row) : vloadn(row, length);
+    }
+    transpose(r);
+    for (size_t k = 0; k < simdWidth && g * simdWidth + k < stride; ++k) fields[g * simdWidth + k] = r[k];
+  }
+}
+
+// The rows are stored record after record, so that the garbage written past
+// the end of a record (when stride is not a multiple of simdWidth) is
+// overwritten by the next record.
+template<size_t stride>
+inline void toTiles(float* p, const vfloat (&fields)[stride]) {
+  vfloat r[groups<stride>][simdWidth];
+  for (size_t g = 0; g < groups<stride>; ++g) {
+    for (size_t k = 0; k < simdWidth; ++k) {
+      r[g][k] = g * simdWidth + k < stride ? fields[g * simdWidth + k] : vzero();
+    }
+    transpose(r[g]);
+  }
+  for (size_t k = 0; k < simdWidth; ++k) {
+    for (size_t g = 0; g < groups<stride>; ++g) {
+      float* row = p + k * stride + g * simdWidth;
+      const size_t length = rowLength<stride>(k, g);
+      if (length == simdWidth) {
+        vstoreu(row, r[g][k]);
+      }
+      else {
+        vstoren(row, r[g][k], length);
+      }
+    }
+  }
+}
+
+// Short records: a tile would transpose mostly zeros, so each field is
+// instead picked from the `stride` registers of the block with one permutation
+// and one blend per register, stride * stride of each in total. That beats the
+// tiles up to stride 5 with AVX-512 and stride 3 with AVX2.
+template<size_t stride>
+constexpr bool permutes = stride * stride < 2 * simdWidth;
+
+// Field k of record r is element e = r * stride + k of the block, lane e %
+// simdWidth of register e / simdWidth.
+template<size_t stride>
+struct Permutations {
+  int32_t fieldLane[stride][simdWidth];   // lane r of field k: lane of its element
+  uint32_t fieldMask[stride][stride];     // lanes of field k found in register j
+  int32_t recordLane[stride][simdWidth];  // lane l of register j: its record
+  uint32_t recordMask[stride][stride];    // lanes of register j taken from field k
+
+  constexpr Permutations() : fieldLane{}, fieldMask{}, recordLane{}, recordMask{} {
+    for (size_t k = 0; k < stride; ++k) {
+      for (size_t r = 0; r < simdWidth; ++r) {
+        const size_t e = r * stride + k;
+        fieldLane[k][r] = int32_t(e % simdWidth);
+        fieldMask[k][e / simdWidth] |= 1u << r;
+        recordLane[e / simdWidth][e % simdWidth] = int32_t(r);
+        recordMask[e / simdWidth][k] |= 1u << (e % simdWidth);
+      }
+    }
+  }
+};
+
+template<size_t stride>
+inline constexpr Permutations<stride> permutations{};
+
+template<size_t stride>
+inline void toFields(const vfloat (&in)[stride], vfloat (&fields)[stride]) {
+  constexpr auto& P = permutations<stride>;
+  for (size_t k = 0; k < stride; ++k) {
+    vfloat f = vzero();
+    for (size_t j = 0; j < stride; ++j) {
+      if (P.fieldMask[k][j] != 0) f = vselect(P.fieldMask[k][j], f, vpermute(in[j], P.fieldLane[k]));
+    }
+    fields[k] = f;
+  }
+}
+
+template<size_t stride>
+inline void toRecords(const vfloat (&fields)[stride], vfloat (&out)[stride]) {
+  constexpr auto& P = permutations<stride>;
+  for (size_t j = 0; j < stride; ++j) {
+    vfloat v = vzero();
+    for (size_t k = 0; k < stride; ++k) {
+      if (P.recordMask[j][k] != 0) v = vselect(P.recordMask[j][k], v, vpermute(fields[k], P.recordLane[j]));
+    }
+    out[j] = v;
+  }
+}
+
+} // namespace transpose_detail
+
+// Stores v at p, with a non-temporal store if `stream` and p is aligned.
+inline void vstoreTo(float* p, vfloat v, bool stream) {
+  if (stream && (uintptr_t)p % (simdWidth * sizeof(float)) == 0) {
+    vstream(p, v);
+  }
+  else {
+    vstoreu(p, v);
+  }
+}
+
+// fields[f] = field f of the simdWidth records of `stride` floats at p.
+template<size_t stride>
+inline void loadRecords(const float* p, vfloat (&fields)[stride]) {
+  if constexpr (transpose_detail::permutes<stride>) {
+    vfloat in[stride];
+    for (size_t j = 0; j < stride; ++j) in[j] = vloadu(p + j * simdWidth);
+    transpose_detail::toFields<stride>(in, fields);
+  }
+  else {
+    transpose_detail::fromTiles<stride>(p, fields);
+  }
+}
+
+// Writes fields[f] into field f of the simdWidth records of `stride` floats at
+// p, with non-temporal stores if `stream` (see vfence).
+template<size_t stride>
+inline void storeRecords(float* p, const vfloat (&fields)[stride], bool stream) {
+  if constexpr (transpose_detail::permutes<stride>) {
+    vfloat out[stride];
+    transpose_detail::toRecords<stride>(fields, out);
+    for (size_t j = 0; j < stride; ++j) vstoreTo(p + j * simdWidth, out[j], stream);
+  }
+  else if (stream) {
+    // Tiles overlap, non-temporal stores need whole aligned registers.
+    alignas(64) float buffer[simdWidth * stride];
+    transpose_detail::toTiles<stride>(buffer, fields);
+    for (size_t j = 0; j < stride; ++j) vstoreTo(p + j * simdWidth, vload(buffer + j * simdWidth), true);
+  }
+  else {
+    transpose_detail::toTiles<stride>(p, fields);
+  }
+}
+
+// In place: the simdWidth records of `stride` floats at p become `stride` rows
+// of simdWidth values, row f holding field f.
+template<size_t stride>
+inline void recordsToRows(float* p) {
+  vfloat fields[stride];
+  loadRecords<stride>(p, fields);
+  for (size_t f = 0; f < stride; ++f) vstoreu(p + f * simdWidth, fields[f]);
+}
+
+// The inverse of recordsToRows.
+template<size_t stride>
+inline void rowsToRecords(float* p) {
+  vfloat fields[stride];
+  for (size_t f = 0; f < stride; ++f) fields[f] = vloadu(p + f * simdWidth);
+  storeRecords<stride>(p, fields, false);
+}
+
+} // namespace simd
+
+#endif //_transpose_h
@@ -0,0 +1,114 @@
+#ifndef _zone_map_h
+#define _zone_map_h
+
+// Zone maps: the minimum and maximum of some float columns over each block of
+// blockSize consecutive elements.
+//
+// A query on a column then reads the summaries (n / 4096 of them) before the
+// data: the extrema of a column are the extrema of its summaries, and a range
+// filter only scans the blocks whose [min, max] intersects the range. A block
+// whose [min, max] lies inside the range matches entirely without being read.
+//
+// The map is only as useful as the data is ordered: on particles stored in
+// random order every block spans the whole domain and nothing is skipped,
+// while on particles sorted along x (as after a cell sort) a thin slab in x
+// touches a few blocks.
+//
+// The summaries are not updated automatically. A kernel that modifies a
+// summarised column must call setZone() for every block it modifies (cheaply,
+// while the block is in the cache), or summarize() afterwards.
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "parallel.h"
+#include "reduction.h"
+
+struct Zone {
+  float lo;
+  float hi;
+};
+
+// Selects the elements whose column `column` lies in [lo, hi].
+struct ZoneFilter {
+  unsigned column;
+  float lo;
+  float hi;
+};
+
+class ZoneMap {
+public:
+  static constexpr size_t blockSize = 4096;
+
+  ZoneMap( size_t _n, unsigned _columns )
+    : n(_n), numColumns(_columns), zones(_columns * blocks(),
+                                         Zone{ std::numeric_limits<float>::infinity(),
+                                               -std::numeric_limits<float>::infinity() }) {}
+
+  size_t size() const { return n; }
+  unsigned columns() const { return numColumns; }
+  size_t blocks() const { return (n + blockSize - 1) / blockSize; }
+  std::pair<size_t, size_t> blockRange(size_t b) const { return { b * blockSize, std::min(n, (b + 1) * blockSize) }; }
+
+  const Zone& zone(unsigned k, size_t b) const { return zones[k * blocks() + b]; }
+  void setZone(unsigned k, size_t b, Zone z) { zones[k * blocks() + b] = z; }
+
+  // The minimum and maximum of [first, last), with the folds of reduction.h.
+  // The second pass reads the block from the L1 cache.
+  static Zone zoneOf(const float* first, const float* last) {
+    auto value = [first](size_t i) { return first[i]; };
+    return { rangeMin(0, last - first, value), rangeMax(0, last - first, value) };
+  }
+
+  // Recomputes the summaries of column k from its data, in parallel.
+  void summarize(unsigned k, const float* column) {
+    parallelFor(blocks(), [&](size_t first, size_t last) {
+      for (size_t b = first; b < last; ++b) {
+        auto [begin, end] = blockRange(b);
+        setZone(k, b, zoneOf(column + begin, column + end));
+      }
+    });
+  }
+
+  float min(unsigned k) const {
+    float m = std::numeric_limits<float>::infinity();
+    for (size_t b = 0; b < blocks(); ++b) m = std::min(m, zone(k, b).lo);
+    return m;
+  }
+
+  float max(unsigned k) const {
+    float m = -std::numeric_limits<float>::infinity();
+    for (size_t b = 0; b < blocks(); ++b) m = std::max(m, zone(k, b).hi);
+    return m;
+  }
+
+  // Calls f(first, last, whole) for the blocks [first, last) that may contain
+  // elements matching all the filters, where `whole` tells that the summaries
+  // prove that all the elements of the block match. Blocks are visited in
+  // order, on the calling thread.
+  template<class F>
+  void forEachCandidate(std::initializer_list<ZoneFilter> filters, F f) const {
+    for (size_t b = 0; b < blocks(); ++b) {
+      bool candidate = true, whole = true;
+      for (const ZoneFilter& flt: filters) {
+        const Zone& z = zone(flt.column, b);
+        candidate &= z.hi >= flt.lo && z.lo <= flt.hi;
+        whole &= z.lo >= flt.lo && z.hi <= flt.hi;
+      }
+      if (candidate) {
+        auto [first, last] = blockRange(b);
+        f(first, last, whole);
+      }
+    }
+  }
+
+private:
+  size_t n;
+  unsigned numColumns;
+  std::vector<Zone> zones;
+};
+
+#endif //_zone_map_h